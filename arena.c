@@ -0,0 +1,87 @@
+#pragma once
+#include "arena.h"
+#include <stdlib.h>
+
+// bytes of the header of a chunk, the memory after it is aligned
+#define ARENA_HEADER_SIZE ((sizeof(ArenaChunk) + SLAB_ALIGN - 1) / SLAB_ALIGN * SLAB_ALIGN)
+
+
+// allocates a chunk of size bytes after the current one
+static int Arena_grow(Arena* arena, long size){
+
+	ArenaChunk* chunk = (ArenaChunk*) malloc(ARENA_HEADER_SIZE + size);
+	if(!chunk) return -1;
+
+	chunk->prev = arena->current;
+	chunk->size = size;
+	chunk->used = 0;
+	arena->current = chunk;
+
+	return 0;
+}
+
+
+// initializes an arena of chunks of chunk_size bytes, and allocates the first one
+int Arena_init(Arena* arena, long chunk_size){
+
+	// security check on input args
+	if(!arena || chunk_size <= 0) return -1;
+
+	arena->current = NULL;
+	arena->chunk_size = chunk_size;
+
+	return Arena_grow(arena, chunk_size);
+}
+
+
+// returns size bytes of the arena, aligned to SLAB_ALIGN
+void* Arena_alloc(Arena* arena, long size){
+
+	// security check on input args
+	if(!arena || !arena->current || size < 0) return NULL;
+
+	size = (size + SLAB_ALIGN - 1) / SLAB_ALIGN * SLAB_ALIGN;
+
+	// a full chunk is followed by a new one, big enough for size
+	if(arena->current->used + size > arena->current->size) {
+		if(Arena_grow(arena, size > arena->chunk_size ? size : arena->chunk_size) == -1) return NULL;
+	}
+
+	void* ptr = (char*) arena->current + ARENA_HEADER_SIZE + arena->current->used;
+	arena->current->used += size;
+
+	return ptr;
+}
+
+
+// returns the current position of the arena
+ArenaMark Arena_mark(Arena* arena){
+
+	ArenaMark mark;
+	mark.chunk = arena->current;
+	mark.used = arena->current ? arena->current->used : 0;
+
+	return mark;
+}
+
+
+// releases the memory handed out since mark was taken
+void Arena_release(Arena* arena, ArenaMark mark){
+
+	// the chunks added after the mark are freed
+	while(arena->current && arena->current != mark.chunk) {
+		ArenaChunk* prev = arena->current->prev;
+		free(arena->current);
+		arena->current = prev;
+	}
+
+	if(arena->current) arena->current->used = mark.used;
+}
+
+
+// frees every chunk of the arena
+void Arena_destroy(Arena* arena){
+
+	ArenaMark none = { NULL, 0 };
+	Arena_release(arena, none);
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include "slab.h"
+
+// a chunk of an arena, its bytes follow the header
+typedef struct ArenaChunk {
+  struct ArenaChunk* prev;   // chunk allocated before, NULL for the first one
+  long size;                 // bytes of the chunk
+  long used;                 // bytes handed out
+} ArenaChunk;
+
+// scratch memory handed out by bumping a pointer, and released in one shot up to a mark
+// the first chunk is kept until Arena_destroy, the ones added when it is full are freed by Arena_release
+typedef struct {
+  ArenaChunk* current;       // chunk the memory is taken from
+  long chunk_size;           // bytes of each chunk, unless a bigger one is asked
+} Arena;
+
+// position of an arena, the memory handed out after it is released together
+typedef struct {
+  ArenaChunk* chunk;
+  long used;
+} ArenaMark;
+
+// initializes an arena of chunks of chunk_size bytes, and allocates the first one
+// returns -1 if the memory is over
+int Arena_init(Arena* arena, long chunk_size);
+
+// returns size bytes of the arena, aligned to SLAB_ALIGN
+// NULL if the memory is over
+void* Arena_alloc(Arena* arena, long size);
+
+// returns the current position of the arena
+ArenaMark Arena_mark(Arena* arena);
+
+// releases the memory handed out since mark was taken
+void Arena_release(Arena* arena, ArenaMark mark);
+
+// frees every chunk of the arena
+void Arena_destroy(Arena* arena);
@@ -2,6 +2,12 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 
 // "num" represents a block's position in memory
@@ -24,11 +30,98 @@ int BitMap_indexToBlock(int entry, uint8_t bit_num) {
 }
 
 
+// loads the 8 bytes starting at entry "entry" as a big endian word, so that
+// the MSB-first order of the bitmap is kept (the highest bit is the lowest block)
+// bytes past the end of the bitmap are read as 0
+static uint64_t BitMap_loadWord(BitMap* bitmap, int entry, int num_entries) {
+
+	uint64_t word = 0;
+	int len = num_entries - entry < 8 ? num_entries - entry : 8;
+	memcpy(&word, bitmap->entries + entry, len);
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	word = __builtin_bswap64(word);
+#endif
+	return word;
+}
+
+
+// returns 1 if every bit of the word "word" is set, bits past num_bits count as set
+static int BitMap_isWordFull(BitMap* bitmap, int word) {
+
+	int num_entries = (bitmap->num_bits + 7) / 8;
+	uint64_t bits = BitMap_loadWord(bitmap, word * 8, num_entries);
+
+	// bits past the end of the bitmap
+	int valid = bitmap->num_bits - word * 64;
+	if(valid < 64) bits |= ~0ULL >> valid;
+
+	return bits == ~0ULL;
+}
+
+
+// updates the summary and the top level after the word "word" changed
+static void BitMap_updateSummary(BitMap* bitmap, int word) {
+
+	int s = word / 64;
+	uint64_t mask = 1ULL << (word % 64);
+	int was_full = bitmap->summary[s] == ~0ULL;
+
+	if(BitMap_isWordFull(bitmap, word)) bitmap->summary[s] |= mask;
+	else bitmap->summary[s] &= ~mask;
+
+	// the top level changes only if the summary word got full or stopped being full
+	int is_full = bitmap->summary[s] == ~0ULL;
+	if(was_full == is_full) return;
+
+	if(is_full) bitmap->top[s / 64] |= 1ULL << (s % 64);
+	else bitmap->top[s / 64] &= ~(1ULL << (s % 64));
+}
+
+
+// initializes the bitmap and builds its summary from entries
+int BitMap_init(BitMap* bitmap, int num_bits, char* entries) {
+
+	bitmap->num_bits = num_bits;
+	bitmap->entries = entries;
+	bitmap->num_words = (num_bits + 63) / 64;
+	bitmap->num_summary = (bitmap->num_words + 63) / 64;
+	bitmap->dirty_first = -1;
+	bitmap->dirty_last = -1;
+
+	int num_top = (bitmap->num_summary + 63) / 64;
+	bitmap->summary = (uint64_t*) calloc(bitmap->num_summary, sizeof(uint64_t));
+	bitmap->top = (uint64_t*) calloc(num_top, sizeof(uint64_t));
+
+	if(!bitmap->summary || !bitmap->top) {
+		BitMap_freeSummary(bitmap);
+		return -1;
+	}
+
+	int i;
+
+	// summary bits past the last word are set, so they never look free
+	for(i = bitmap->num_words; i < bitmap->num_summary * 64; i++) {
+		bitmap->summary[i / 64] |= 1ULL << (i % 64);
+	}
+	for(i = 0; i < bitmap->num_words; i++) {
+		if(BitMap_isWordFull(bitmap, i)) bitmap->summary[i / 64] |= 1ULL << (i % 64);
+	}
+
+	// same for the top level
+	for(i = 0; i < num_top * 64; i++) {
+		if(i >= bitmap->num_summary || bitmap->summary[i] == ~0ULL) bitmap->top[i / 64] |= 1ULL << (i % 64);
+	}
+
+	return 0;
+}
+
+
 // sets the bit at index pos in bitmap to status
  int BitMap_set(BitMap* bitmap, int pos, int status) {
 	
 	// security check on the bitmap's size
-	if(pos > bitmap->num_bits) return -1;
+	if(pos < 0 || pos >= bitmap->num_bits) return -1;
 
 	// declares the bitmap entry key and bit mask
     BitMapEntryKey block_info = BitMap_blockToIndex(pos);
@@ -39,44 +132,239 @@ int BitMap_indexToBlock(int entry, uint8_t bit_num) {
 	}else{
 		bitmap->entries[block_info.entry_num] &= ~(mask);
 	}
+
+	// keeps the summary consistent
+	if(bitmap->summary) BitMap_updateSummary(bitmap, pos / 64);
+
+	// records the changed entry
+	if(bitmap->dirty_first == -1 || block_info.entry_num < bitmap->dirty_first) bitmap->dirty_first = block_info.entry_num;
+	if(block_info.entry_num > bitmap->dirty_last) bitmap->dirty_last = block_info.entry_num;
 	
     return status;
  }
 
 
+// clears the n bits at the positions in pos, sorted in increasing order
+// the bits falling in the same 64 bits word are cleared together, and the summary updated once for it
+// returns the number of bits that were set
+int BitMap_clearSorted(BitMap* bitmap, const int* pos, int n) {
+
+	int num_entries = (bitmap->num_bits + 7) / 8;
+	int i = 0, cleared = 0;
+
+	while(i < n) {
+
+		// the mask of the bits of the same word, MSB first as in loadWord
+		int word = pos[i] / 64;
+		uint64_t mask = 0;
+		for(; i < n && pos[i] / 64 == word; i++) mask |= 1ULL << (63 - pos[i] % 64);
+
+		uint64_t bits = BitMap_loadWord(bitmap, word * 8, num_entries);
+		cleared += __builtin_popcountll(bits & mask);
+		bits &= ~mask;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		bits = __builtin_bswap64(bits);
+#endif
+		int len = num_entries - word * 8 < 8 ? num_entries - word * 8 : 8;
+		memcpy(bitmap->entries + word * 8, &bits, len);
+
+		if(bitmap->summary) BitMap_updateSummary(bitmap, word);
+
+		if(bitmap->dirty_first == -1 || word * 8 < bitmap->dirty_first) bitmap->dirty_first = word * 8;
+		if(word * 8 + len - 1 > bitmap->dirty_last) bitmap->dirty_last = word * 8 + len - 1;
+	}
+
+	return cleared;
+}
+
+
+// skips the entries equal to "fill" starting from entry (a multiple of 8)
+// returns the first entry of the chunk containing a different byte
+static int BitMap_skipEntries(BitMap* bitmap, int entry, int num_entries, int fill) {
+
+	const unsigned char* bytes = (const unsigned char*) bitmap->entries;
+
+#if defined(__AVX2__)
+	const __m256i pattern256 = _mm256_set1_epi8((char) fill);
+	while(entry + 32 <= num_entries) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i*) (bytes + entry));
+		if(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, pattern256)) != -1) break;
+		entry += 32;
+	}
+#endif
+#if defined(__SSE2__)
+	const __m128i pattern128 = _mm_set1_epi8((char) fill);
+	while(entry + 16 <= num_entries) {
+		__m128i chunk = _mm_loadu_si128((const __m128i*) (bytes + entry));
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, pattern128)) != 0xFFFF) break;
+		entry += 16;
+	}
+#endif
+	// scalar fallback, one word at a time
+	const uint64_t pattern64 = fill ? ~0ULL : 0ULL;
+	while(entry + 8 <= num_entries) {
+		uint64_t word;
+		memcpy(&word, bytes + entry, 8);
+		if(word != pattern64) break;
+		entry += 8;
+	}
+
+	return entry;
+}
+
+
+// returns the first word not full from word "word", using the summary levels
+// returns -1 if every word from "word" is full
+static int BitMap_nextFreeWord(BitMap* bitmap, int word) {
+
+	if(word >= bitmap->num_words) return -1;
+
+	// looks in the summary word containing "word"
+	int s = word / 64;
+	uint64_t free_words = ~bitmap->summary[s] & (~0ULL << (word % 64));
+
+	if(!free_words) {
+
+		// looks in the top level for the next summary word not full
+		int num_top = (bitmap->num_summary + 63) / 64;
+		int t = (s + 1) / 64;
+		if(s + 1 >= bitmap->num_summary) return -1;
+
+		uint64_t free_summary = ~bitmap->top[t] & (~0ULL << ((s + 1) % 64));
+		while(!free_summary) {
+			if(++t >= num_top) return -1;
+			free_summary = ~bitmap->top[t];
+		}
+
+		s = t * 64 + __builtin_ctzll(free_summary);
+		free_words = ~bitmap->summary[s];
+	}
+
+	return s * 64 + __builtin_ctzll(free_words);
+}
+
+
 // returns the index of the first bit having status "status" in the bitmap, and starts looking from position start
 int BitMap_get(BitMap* bitmap, int start, int status) {
 
 	// security check on the bitmap's size
-	if(start > bitmap->num_bits) return -1;
+	if(start > bitmap->num_bits || start < 0) return -1;
+
+	int num_entries = (bitmap->num_bits + 7) / 8;
 
-	int pos, idx, res;
+	// the bitmap is scanned a word (64 bits) at a time, starting from the word containing start
+	int entry = (start / 64) * 8;
+	if(entry >= num_entries) return -1;
 
-	// for each bit from start
-	// security check guaranteed by the cycle
-	for(idx = start; idx < bitmap->num_bits; idx++) {
+	// looking for a 0 is looking for a 1 in the negated word
+	uint64_t word = BitMap_loadWord(bitmap, entry, num_entries);
+	if(!status) word = ~word;
 
-		//~ if(idx == bitmap->num_bits) return -1;
-		
-		BitMapEntryKey block_info = BitMap_blockToIndex(idx);
-	 	res = bitmap->entries[block_info.entry_num] & (1 << (7 - block_info.bit_num)); 
+	// discards the bits before start
+	word &= ~0ULL >> (start % 64);
 
-		// if status is 1, "res" must be greater than 0
-		if(status) {
-			if(res > 0) return idx;
-		}else{
-			if(!res) return idx;
+	while(!word) {
+		entry += 8;
+
+		// free bits are found through the summary, skipping the full words
+		if(!status && bitmap->summary) {
+			int next = BitMap_nextFreeWord(bitmap, entry / 8);
+			if(next == -1) return -1;
+			entry = next * 8;
+			word = ~BitMap_loadWord(bitmap, entry, num_entries);
+			continue;
 		}
+
+		// skips the words with every bit different from status
+		entry = BitMap_skipEntries(bitmap, entry, num_entries, status ? 0x00 : 0xFF);
+		if(entry >= num_entries) return -1;
+
+		word = BitMap_loadWord(bitmap, entry, num_entries);
+		if(!status) word = ~word;
 	}
-	
+
+	// the first bit having status "status" is the highest one set in word
+	int idx = BitMap_indexToBlock(entry, 0) + __builtin_clzll(word);
+
 	// error: index out of range bitmap->num_bits
+	if(idx >= bitmap->num_bits) return -1;
+
+	return idx;
+}
+
+
+// returns the number of consecutive bits having status "status" from position start, at most max
+int BitMap_runLength(BitMap* bitmap, int start, int max, int status) {
+
+	// security check on the bitmap's size
+	if(start >= bitmap->num_bits || start < 0 || max <= 0) return 0;
+
+	// the run ends at the first bit having the other status
+	int end = BitMap_get(bitmap, start, !status);
+	if(end == -1) end = bitmap->num_bits;
+
+	return end - start < max ? end - start : max;
+}
+
+
+// returns the index of the first run of len bits having status "status", and starts looking from position start
+int BitMap_getRun(BitMap* bitmap, int start, int len, int status) {
+
+	// security check on input args
+	if(len <= 0) return -1;
+
+	while(start < bitmap->num_bits) {
+
+		// the first bit of a candidate run
+		int pos = BitMap_get(bitmap, start, status);
+		if(pos == -1) return -1;
+
+		int run = BitMap_runLength(bitmap, pos, len, status);
+		if(run >= len) return pos;
+
+		// the run is too short, the bit after it has the other status
+		start = pos + run + 1;
+	}
+
 	return -1;
 }
 
 
+// returns the number of bits having status "status" in the bitmap
+int BitMap_count(BitMap* bitmap, int status) {
+
+	int num_entries = (bitmap->num_bits + 7) / 8;
+	int entry, count = 0;
+
+	for(entry = 0; entry < num_entries; entry += 8) {
+		uint64_t word = BitMap_loadWord(bitmap, entry, num_entries);
+
+		// discards the bits past the end of the bitmap
+		int valid = bitmap->num_bits - entry * 8;
+		if(valid < 64) word &= ~(~0ULL >> valid);
+
+		count += __builtin_popcountll(word);
+	}
+
+	return status ? count : bitmap->num_bits - count;
+}
+
+
+// frees the in memory summary, leaving entries untouched
+void BitMap_freeSummary(BitMap* bitmap){
+
+	free(bitmap->summary);
+	free(bitmap->top);
+	bitmap->summary = NULL;
+	bitmap->top = NULL;
+}
+
+
 // frees bitmap resources
 int BitMap_destroy(BitMap* bitmap){
 
+	BitMap_freeSummary(bitmap);
 	free(bitmap->entries);
 	free(bitmap);
 	return 0;
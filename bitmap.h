@@ -3,6 +3,12 @@
 typedef struct{
   int num_bits;
   char* entries;
+  uint64_t* summary;   // in memory only: a bit for each 64 bits word of entries, set if the word is full
+  uint64_t* top;       // in memory only: a bit for each summary word, set if the summary word is full
+  int num_words;       // number of 64 bits words covering entries
+  int num_summary;     // number of summary words
+  int dirty_first;     // first entry changed by BitMap_set (-1 if none)
+  int dirty_last;      // last entry changed by BitMap_set
 }  BitMap;
 
 typedef struct {
@@ -17,12 +23,38 @@ BitMapEntryKey BitMap_blockToIndex(int num);
 // converts a bit to a linear index
 int BitMap_indexToBlock(int entry, uint8_t bit_num);
 
+// initializes bmap over num_bits bits stored in entries
+// and builds the in memory summary used to look for free bits
+// returns -1 if the summary can't be allocated (searches fall back to the linear scan)
+int BitMap_init(BitMap* bmap, int num_bits, char* entries);
+
 // returns the index of the first bit having status "status"
 // in the bitmap bmap, and starts looking from position start
 int BitMap_get(BitMap* bmap, int start, int status);
 
+// returns the number of consecutive bits having status "status" in bmap
+// from position start, at most max
+int BitMap_runLength(BitMap* bmap, int start, int max, int status);
+
+// returns the index of the first run of len bits having status "status"
+// in the bitmap bmap, and starts looking from position start
+// -1 if there is no such run
+int BitMap_getRun(BitMap* bmap, int start, int len, int status);
+
+// returns the number of bits having status "status" in bmap
+int BitMap_count(BitMap* bmap, int status);
+
 // sets the bit at index pos in bmap to status
+// the changed entry is added to the range [dirty_first, dirty_last]
 int BitMap_set(BitMap* bmap, int pos, int status);
 
+// clears the n bits at the positions in pos, sorted in increasing order and smaller than num_bits
+// the bits of each 64 bits word are cleared at once
+// returns the number of bits that were set
+int BitMap_clearSorted(BitMap* bmap, const int* pos, int n);
+
+// frees the in memory summary, leaving entries untouched
+void BitMap_freeSummary(BitMap* bmap);
+
 // frees bitmap resources
 int BitMap_destroy(BitMap* bmap);
@@ -0,0 +1,364 @@
+#pragma once
+#include "block_cache.h"
+#include <string.h>
+#include <stdlib.h>
+
+
+// returns the block held by the frame i
+static char* BlockCache_frameData(BlockCache* cache, int i){
+
+	return cache->data + (long) i * cache->disk->block_size;
+}
+
+
+// returns the frame holding the block at address block, -1 if the address is not in the cache
+static int BlockCache_frameOf(BlockCache* cache, const void* block){
+
+	const char* addr = (const char*) block;
+	if(!cache->num_frames || addr < cache->data || addr >= BlockCache_frameData(cache, cache->num_frames)) return -1;
+
+	return (addr - cache->data) / cache->disk->block_size;
+}
+
+
+// returns 1 if the block block_num is free according to the bitmap
+static int BlockCache_isFree(BlockCache* cache, int block_num){
+
+	return BitMap_get(cache->disk->map, block_num, 0) == block_num;
+}
+
+
+// returns the frame holding block_num, -1 if not cached
+static int BlockCache_find(BlockCache* cache, int block_num){
+
+	int i = cache->buckets[block_num % cache->num_buckets];
+	while(i != -1 && cache->frames[i].block_num != block_num) i = cache->frames[i].next_hash;
+
+	return i;
+}
+
+
+// removes the frame i from its bucket, leaving it free
+static void BlockCache_unhash(BlockCache* cache, int i){
+
+	BlockFrame* frame = &cache->frames[i];
+	if(frame->block_num == -1) return;
+
+	int* link = &cache->buckets[frame->block_num % cache->num_buckets];
+	while(*link != i) link = &cache->frames[*link].next_hash;
+	*link = frame->next_hash;
+
+	frame->block_num = -1;
+	frame->next_hash = -1;
+	frame->dirty = 0;
+}
+
+
+// returns a free frame, evicting the first block not referenced since the last turn of the hand
+// a changed block is written back before being evicted
+// -1 if every frame is pinned
+static int BlockCache_victim(BlockCache* cache){
+
+	int turns;
+	for(turns = 0; turns < 2 * cache->num_frames; turns++) {
+
+		int i = cache->hand;
+		BlockFrame* frame = &cache->frames[i];
+		cache->hand = (cache->hand + 1) % cache->num_frames;
+
+		if(frame->pins) continue;
+		if(frame->block_num != -1 && frame->referenced) {
+			frame->referenced = 0;
+			continue;
+		}
+
+		if(frame->dirty) {
+			if(DiskDriver_writeBlock(cache->disk, BlockCache_frameData(cache, i), frame->block_num) == -1) continue;
+			cache->writebacks++;
+		}
+		BlockCache_unhash(cache, i);
+		return i;
+	}
+
+	return -1;
+}
+
+
+// returns the frame holding block_num, loading it if not cached
+// with read set the block is read from the disk, if used (a free block is zeroed, or it is an error if read is 2)
+// -1 if the block can't be read or every frame is pinned
+static int BlockCache_load(BlockCache* cache, int block_num, int read){
+
+	if(!cache->num_frames) return -1;
+
+	int i = BlockCache_find(cache, block_num);
+	if(i != -1) {
+		cache->hits++;
+		cache->frames[i].referenced = 1;
+		return i;
+	}
+
+	i = BlockCache_victim(cache);
+	if(i == -1) return -1;
+
+	char* data = BlockCache_frameData(cache, i);
+	if(read && !BlockCache_isFree(cache, block_num)) {
+		if(DiskDriver_readBlock(cache->disk, data, block_num) == -1) return -1;
+		cache->misses++;
+	}
+	else if(read == 2) return -1;
+	else memset(data, 0, cache->disk->block_size);
+
+	BlockFrame* frame = &cache->frames[i];
+	frame->block_num = block_num;
+	frame->referenced = 1;
+	frame->dirty = 0;
+	frame->next_hash = cache->buckets[block_num % cache->num_buckets];
+	cache->buckets[block_num % cache->num_buckets] = i;
+
+	return i;
+}
+
+
+// initializes a cache of num_frames blocks over disk
+int BlockCache_init(BlockCache* cache, DiskDriver* disk, int num_frames){
+
+	// security check on input args
+	if(!cache || !disk || num_frames < 0) return -1;
+
+	cache->disk = disk;
+	cache->num_frames = num_frames;
+	cache->num_buckets = num_frames ? 2 * num_frames : 1;
+	cache->hand = 0;
+	cache->hits = 0;
+	cache->misses = 0;
+	cache->writebacks = 0;
+
+	cache->frames = (BlockFrame*) calloc(num_frames ? num_frames : 1, sizeof(BlockFrame));
+	cache->data = (char*) malloc((num_frames ? num_frames : 1) * (long) disk->block_size);
+	cache->buckets = (int*) malloc(cache->num_buckets * sizeof(int));
+
+	if(!cache->frames || !cache->data || !cache->buckets) {
+		free(cache->frames);
+		free(cache->data);
+		free(cache->buckets);
+		cache->num_frames = 0;
+		cache->frames = NULL;
+		cache->data = NULL;
+		cache->buckets = NULL;
+		return -1;
+	}
+
+	int i;
+	for(i = 0; i < cache->num_buckets; i++) cache->buckets[i] = -1;
+	for(i = 0; i < num_frames; i++) {
+		cache->frames[i].block_num = -1;
+		cache->frames[i].next_hash = -1;
+	}
+
+	return 0;
+}
+
+
+// reads the block in position block_num, from the cache if there
+int BlockCache_readBlock(BlockCache* cache, void* dest, int block_num){
+
+	// security check on disk size, and on the bitmap
+	if(block_num >= cache->disk->header->num_blocks || block_num < 0) return -1;
+	if(BlockCache_isFree(cache, block_num)) return -1;
+
+	int i = BlockCache_load(cache, block_num, 2);
+	if(i == -1) return DiskDriver_readBlock(cache->disk, dest, block_num);
+
+	memcpy(dest, BlockCache_frameData(cache, i), cache->disk->block_size);
+	return 0;
+}
+
+
+// writes a block in position block_num, in the cache until written back
+int BlockCache_writeBlock(BlockCache* cache, const void* src, int block_num){
+
+	// security check on disk size
+	if(block_num >= cache->disk->header->num_blocks || block_num < 0) return -1;
+
+	// the whole block is replaced, it is not read
+	int i = BlockCache_load(cache, block_num, 0);
+	if(i == -1) return DiskDriver_writeBlock(cache->disk, (void*) src, block_num);
+
+	// the block is taken at once, so that it isn't allocated again before being written back
+	if(BlockCache_isFree(cache, block_num) && DiskDriver_reserveBlocks(cache->disk, block_num, 1) == -1) return -1;
+
+	memcpy(BlockCache_frameData(cache, i), src, cache->disk->block_size);
+	cache->frames[i].dirty = 1;
+	return 0;
+}
+
+
+// returns a pointer to the copy of the block in position block_num in the cache
+const void* BlockCache_getBlock(BlockCache* cache, int block_num){
+
+	// security check on disk size, and on the bitmap
+	if(block_num >= cache->disk->header->num_blocks || block_num < 0) return NULL;
+	if(BlockCache_isFree(cache, block_num)) return NULL;
+
+	int i = BlockCache_load(cache, block_num, 2);
+	if(i == -1) return DiskDriver_getBlock(cache->disk, block_num);
+
+	cache->frames[i].pins++;
+	return BlockCache_frameData(cache, i);
+}
+
+
+// releases a block returned by BlockCache_getBlock
+void BlockCache_putBlock(BlockCache* cache, const void* block){
+
+	if(!block) return;
+
+	int i = BlockCache_frameOf(cache, block);
+	if(i == -1) DiskDriver_putBlock(cache->disk, block);
+	else cache->frames[i].pins--;
+}
+
+
+// returns a writable pointer to the copy of the block in position block_num in the cache
+void* BlockCache_pinBlock(BlockCache* cache, int block_num){
+
+	// security check on disk size
+	if(block_num >= cache->disk->header->num_blocks || block_num < 0) return NULL;
+
+	int i = BlockCache_load(cache, block_num, 1);
+	if(i == -1) return DiskDriver_pinBlock(cache->disk, block_num);
+
+	cache->frames[i].pins++;
+	return BlockCache_frameData(cache, i);
+}
+
+
+// returns a writable pointer to a zeroed copy of the block in position block_num, without reading it
+void* BlockCache_pinNewBlock(BlockCache* cache, int block_num){
+
+	// security check on disk size
+	if(block_num >= cache->disk->header->num_blocks || block_num < 0) return NULL;
+
+	char* block;
+	int i = BlockCache_load(cache, block_num, 0);
+	if(i == -1) block = (char*) DiskDriver_pinBlock(cache->disk, block_num);
+	else {
+		cache->frames[i].pins++;
+		block = BlockCache_frameData(cache, i);
+	}
+
+	if(block) memset(block, 0, cache->disk->block_size);
+	return block;
+}
+
+
+// commits the changes made to a block returned by BlockCache_pinBlock
+int BlockCache_commitBlock(BlockCache* cache, void* block, int block_num){
+
+	// security check on disk size
+	if(!block || block_num >= cache->disk->header->num_blocks || block_num < 0) return -1;
+
+	int i = BlockCache_frameOf(cache, block);
+	if(i == -1) return DiskDriver_commitBlock(cache->disk, block, block_num);
+
+	cache->frames[i].pins--;
+	if(BlockCache_isFree(cache, block_num) && DiskDriver_reserveBlocks(cache->disk, block_num, 1) == -1) return -1;
+
+	cache->frames[i].dirty = 1;
+	return 0;
+}
+
+
+// frees the n blocks in block_nums, dropping their copies from the cache
+int BlockCache_freeBlocks(BlockCache* cache, const int* block_nums, int n){
+
+	// security check on input args
+	if(!block_nums || n < 0) return -1;
+
+	int i;
+	for(i = 0; i < n; i++) {
+		if(block_nums[i] >= cache->disk->header->num_blocks || block_nums[i] < 0) return -1;
+	}
+
+	// the changes to a block freed are not written back
+	for(i = 0; i < n && cache->num_frames; i++) {
+		int frame = BlockCache_find(cache, block_nums[i]);
+		if(frame != -1) BlockCache_unhash(cache, frame);
+	}
+
+	return DiskDriver_freeBlocks(cache->disk, block_nums, n);
+}
+
+
+// frees the block in position block_num
+int BlockCache_freeBlock(BlockCache* cache, int block_num){
+
+	return BlockCache_freeBlocks(cache, &block_num, 1);
+}
+
+
+// drops every block from the cache, without writing back the changes
+void BlockCache_invalidate(BlockCache* cache){
+
+	int i;
+	for(i = 0; i < cache->num_frames; i++) BlockCache_unhash(cache, i);
+}
+
+
+// writes back the changed blocks, in one batch
+int BlockCache_flush(BlockCache* cache){
+
+	int* block_nums = (int*) malloc((cache->num_frames ? cache->num_frames : 1) * sizeof(int));
+	void** bufs = (void**) malloc((cache->num_frames ? cache->num_frames : 1) * sizeof(void*));
+	if(!block_nums || !bufs) {
+		free(block_nums);
+		free(bufs);
+		return -1;
+	}
+
+	int i, n = 0;
+	for(i = 0; i < cache->num_frames; i++) {
+		if(!cache->frames[i].dirty) continue;
+		block_nums[n] = cache->frames[i].block_num;
+		bufs[n++] = BlockCache_frameData(cache, i);
+	}
+
+	// contiguous blocks are written together
+	int ret = DiskDriver_writeBlocks(cache->disk, block_nums, bufs, n);
+	if(ret != -1) {
+		for(i = 0; i < cache->num_frames; i++) cache->frames[i].dirty = 0;
+		cache->writebacks += n;
+	}
+
+	free(block_nums);
+	free(bufs);
+	return ret;
+}
+
+
+// ends a file system operation, writing back the changed blocks and synchronizing the disk
+int BlockCache_sync(BlockCache* cache){
+
+	int ret = BlockCache_flush(cache);
+	if(DiskDriver_sync(cache->disk) == -1) ret = -1;
+
+	return ret;
+}
+
+
+// writes back the changed blocks and frees cache resources
+int BlockCache_destroy(BlockCache* cache){
+
+	int ret = BlockCache_flush(cache);
+
+	free(cache->frames);
+	free(cache->data);
+	free(cache->buckets);
+	cache->frames = NULL;
+	cache->data = NULL;
+	cache->buckets = NULL;
+	cache->num_frames = 0;
+
+	return ret;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "disk_driver.h"
+
+// frames of the cache of a file system, unless configured otherwise
+#define BLOCK_CACHE_DEFAULT_FRAMES 64
+
+// a frame of the cache, holding a copy of a block
+typedef struct {
+  int block_num;       // block held, -1 if the frame is free
+  int dirty;           // changed since read, written back by BlockCache_flush or when evicted
+  int referenced;      // CLOCK reference bit, set at every use
+  int pins;            // users of the frame (getBlock, pinBlock), it is never evicted while > 0
+  int next_hash;       // next frame of the same bucket, -1 if last
+} BlockFrame;
+
+// cache of blocks between the file system and the disk driver
+// the blocks are looked up by number in a hash table, and evicted with the CLOCK algorithm
+// the changes are written back in one batch by BlockCache_flush
+typedef struct {
+  DiskDriver* disk;
+  int num_frames;      // 0 disables the cache, every call goes to the disk
+  int num_buckets;
+  BlockFrame* frames;
+  char* data;          // num_frames blocks, the block of frames[i] at data + i*block_size
+  int* buckets;        // first frame of each bucket, -1 if empty
+  int hand;            // next frame looked at by CLOCK
+  long hits;           // blocks found in the cache
+  long misses;         // blocks read from the disk
+  long writebacks;     // blocks written to the disk
+} BlockCache;
+
+// initializes a cache of num_frames blocks over disk (0 disables it)
+// returns -1 if the frames can't be allocated
+int BlockCache_init(BlockCache* cache, DiskDriver* disk, int num_frames);
+
+// reads the block in position block_num, from the cache if there
+// returns -1 if the block is free according to the bitmap
+// 0 otherwise
+int BlockCache_readBlock(BlockCache* cache, void* dest, int block_num);
+
+// writes a block in position block_num, in the cache until written back
+// the block is marked as used in the bitmap at once
+// returns -1 if operation not possible
+int BlockCache_writeBlock(BlockCache* cache, const void* src, int block_num);
+
+// returns a pointer to the copy of the block in position block_num in the cache
+// NULL if the block is free according to the bitmap or out of range
+// the block must not be changed through the pointer, and is released by BlockCache_putBlock
+const void* BlockCache_getBlock(BlockCache* cache, int block_num);
+
+// releases a block returned by BlockCache_getBlock
+void BlockCache_putBlock(BlockCache* cache, const void* block);
+
+// returns a writable pointer to the copy of the block in position block_num in the cache (NULL if out of range)
+// the changes are applied by BlockCache_commitBlock
+void* BlockCache_pinBlock(BlockCache* cache, int block_num);
+
+// as BlockCache_pinBlock, for a block written from scratch: the copy is zeroed, without reading the block
+void* BlockCache_pinNewBlock(BlockCache* cache, int block_num);
+
+// commits the changes made to a block returned by BlockCache_pinBlock, and marks it as used in the bitmap
+// the block can't be used anymore after the call
+// returns -1 if operation not possible
+int BlockCache_commitBlock(BlockCache* cache, void* block, int block_num);
+
+// frees the n blocks in block_nums, dropping their copies from the cache
+// returns -1 if operation not possible
+int BlockCache_freeBlocks(BlockCache* cache, const int* block_nums, int n);
+
+// frees the block in position block_num
+// returns -1 if operation not possible
+int BlockCache_freeBlock(BlockCache* cache, int block_num);
+
+// drops every block from the cache, without writing back the changes
+void BlockCache_invalidate(BlockCache* cache);
+
+// writes back the changed blocks, in one batch
+// returns -1 if operation not possible
+int BlockCache_flush(BlockCache* cache);
+
+// ends a file system operation, writing back the changed blocks and synchronizing the disk (DiskDriver_sync)
+int BlockCache_sync(BlockCache* cache);
+
+// writes back the changed blocks and frees cache resources
+int BlockCache_destroy(BlockCache* cache);
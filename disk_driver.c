@@ -8,71 +8,909 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
 
-// opens the file (creating it if necessary)
-// allocates the necessary space on the disk
-// calculates how big the bitmap should be
-// if the file was new
-// compiles a disk header, and fills in the bitmap of appropriate size
-// with all 0 (to denote the free space);
-void DiskDriver_init(DiskDriver* disk, const char* filename, int num_blocks){
-	
-	int file_descriptor;
+// size of the image, header and bitmap included
+static long DiskDriver_size(DiskDriver* disk){
+
+	return sizeof(DiskHeader) + (long) disk->header->num_blocks + (long) disk->header->num_blocks*disk->block_size;
+}
+
+
+// returns the offset of the block block_num in the image
+static long DiskDriver_blockOffset(DiskDriver* disk, int block_num){
+
+	return sizeof(DiskHeader) + (long) disk->header->num_blocks + (long) block_num*disk->block_size;
+}
+
+
+// marks as dirty the pages containing the bytes [offset, offset+len) of the image
+// the caller holds disk->lock
+static void DiskDriver_markRange(DiskDriver* disk, long offset, long len){
+
+	long page;
+	for(page = offset / disk->page_size; page <= (offset + len - 1) / disk->page_size; page++) {
+		BitMap_set(disk->dirty, page, 1);
+	}
+}
+
+
+// marks as dirty the pages of the bitmap changed since the last call
+// and the header with them, since its counters follow the bitmap
+// the caller holds disk->lock, under which the bitmap is also changed
+static void DiskDriver_markBitmap(DiskDriver* disk){
+
+	BitMap* map = disk->map;
+	if(map->dirty_first == -1) return;
+
+	DiskDriver_markRange(disk, 0, sizeof(DiskHeader));
+	DiskDriver_markRange(disk, sizeof(DiskHeader) + map->dirty_first, map->dirty_last - map->dirty_first + 1);
+	map->dirty_first = -1;
+	map->dirty_last = -1;
+}
+
+
+// records that the n blocks in block_nums and the bitmap changed
+static void DiskDriver_markDirty(DiskDriver* disk, const int* block_nums, int n){
+
+	pthread_mutex_lock(&disk->lock);
+
+	DiskDriver_markBitmap(disk);
+
+	int i;
+	for(i = 0; i < n; i++) {
+		DiskDriver_markRange(disk, DiskDriver_blockOffset(disk, block_nums[i]), disk->block_size);
+	}
+
+	pthread_mutex_unlock(&disk->lock);
+}
+
+
+// records that the header changed, without the bitmap
+static void DiskDriver_markHeader(DiskDriver* disk){
+
+	pthread_mutex_lock(&disk->lock);
+	DiskDriver_markRange(disk, 0, sizeof(DiskHeader));
+	pthread_mutex_unlock(&disk->lock);
+}
+
+
+// flushes after a block change, if the sync mode requires it
+static int DiskDriver_opSync(DiskDriver* disk){
+
+	if(disk->sync_mode != DISK_SYNC_EVERY_OP) return 0;
+	return DiskDriver_flush(disk);
+}
+
+
+// body of the background flusher, flushes every flush_interval milliseconds
+static void* DiskDriver_flusher(void* arg){
+
+	DiskDriver* disk = (DiskDriver*) arg;
+
+	pthread_mutex_lock(&disk->lock);
+	while(disk->flusher_running) {
+
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += disk->flush_interval / 1000;
+		deadline.tv_nsec += (long) (disk->flush_interval % 1000) * 1000000;
+		if(deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+
+		// waits for the interval to expire, or for the thread to be stopped
+		if(pthread_cond_timedwait(&disk->wakeup, &disk->lock, &deadline) != ETIMEDOUT) continue;
+
+		pthread_mutex_unlock(&disk->lock);
+		DiskDriver_flush(disk);
+		pthread_mutex_lock(&disk->lock);
+	}
+	pthread_mutex_unlock(&disk->lock);
+
+	return NULL;
+}
+
+
+// stops the background flusher if running
+static void DiskDriver_stopFlusher(DiskDriver* disk){
+
+	if(!disk->flusher_running) return;
+
+	pthread_mutex_lock(&disk->lock);
+	disk->flusher_running = 0;
+	pthread_cond_signal(&disk->wakeup);
+	pthread_mutex_unlock(&disk->lock);
+
+	pthread_join(disk->flusher, NULL);
+}
+
+
+// marks the n blocks in block_nums as used after they have been written, and alters the bitmap accordingly
+static int DiskDriver_allocate(DiskDriver* disk, const int* block_nums, int n){
 	
-	if(!access(filename, F_OK)) { // file already exists
-		
-		file_descriptor = open(filename, O_RDWR, 0666);
-		
-		if(!file_descriptor) {
-			printf("File opening error\n");
-			return;
+	int i, hint_taken = 0;
+	pthread_mutex_lock(&disk->lock);
+	for(i = 0; i < n; i++) {
+
+		// if the block was free
+		if(BitMap_get(disk->map,block_nums[i],0) == block_nums[i]) {
+
+			// decreases the number of free blocks in the disk header
+			disk->header->free_blocks--;
+			BitMap_set(disk->map, block_nums[i], 1);
+
+			if(block_nums[i] == disk->header->first_free_block) hint_taken = 1;
+		}
+	}
+
+	// the first free block changes only if it has just been taken,
+	// and the next one can only be after it
+	if(hint_taken)
+		disk->header->first_free_block = DiskDriver_getFreeBlock(disk, disk->header->first_free_block);
+	pthread_mutex_unlock(&disk->lock);
+
+	DiskDriver_markDirty(disk, block_nums, n);
+
+	// synchronizes mmapped memory
+	if(DiskDriver_opSync(disk) == -1) return -1;
+
+  return 0;	
+}
+
+
+/******************* mmap engine *******************/
+
+// maps the whole image
+static int DiskDriver_mmapOpen(DiskDriver* disk, long size){
+
+	void* image = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, disk->fd, 0);
+	if(image == MAP_FAILED) return -1;
+
+	disk->header = (DiskHeader*) image;
+	return 0;
+}
+
+
+// returns the address of the block block_num in the mapping
+static void* DiskDriver_mmapGetBlock(DiskDriver* disk, int block_num){
+
+	return (char*) disk->header + DiskDriver_blockOffset(disk, block_num);
+}
+
+
+static int DiskDriver_mmapRead(DiskDriver* disk, void* dest, int block_num){
+
+	memcpy(dest, DiskDriver_mmapGetBlock(disk, block_num), disk->block_size);
+	return 0;
+}
+
+
+static int DiskDriver_mmapWrite(DiskDriver* disk, const void* src, int block_num){
+
+	memcpy(DiskDriver_mmapGetBlock(disk, block_num), src, disk->block_size);
+	return 0;
+}
+
+
+// the blocks are changed in place, so there is nothing to release or write back
+static int DiskDriver_mmapPutBlock(DiskDriver* disk, void* block, int block_num, int write_back){
+
+	return 0;
+}
+
+
+// msync wants a page aligned offset, the flush passes whole pages
+static int DiskDriver_mmapSync(DiskDriver* disk, long offset, long len){
+
+	return msync((char*) disk->header + offset, len, MS_SYNC);
+}
+
+
+// msync with MS_SYNC has already waited for the writes
+static int DiskDriver_mmapBarrier(DiskDriver* disk){
+
+	return 0;
+}
+
+
+static int DiskDriver_mmapSubmit(DiskDriver* disk, DiskIo* ios, int n){
+
+	int i;
+	for(i = 0; i < n; i++) {
+		if(ios[i].write) DiskDriver_mmapWrite(disk, ios[i].buf, ios[i].block_num);
+		else DiskDriver_mmapRead(disk, ios[i].buf, ios[i].block_num);
+	}
+	return 0;
+}
+
+
+static void DiskDriver_mmapClose(DiskDriver* disk){
+
+	munmap(disk->header, DiskDriver_size(disk));
+}
+
+
+static const DiskBackend DiskDriver_mmapBackend = {
+	"mmap",
+	DiskDriver_mmapOpen,
+	DiskDriver_mmapRead,
+	DiskDriver_mmapWrite,
+	DiskDriver_mmapGetBlock,
+	DiskDriver_mmapPutBlock,
+	DiskDriver_mmapSync,
+	DiskDriver_mmapBarrier,
+	DiskDriver_mmapSubmit,
+	DiskDriver_mmapClose
+};
+
+
+/******************* pread/pwrite engine *******************/
+
+// moves len bytes between buf and the image at offset, reading (write = 0) or writing (write = 1)
+// bytes past the end of the file are read as 0
+// with O_DIRECT the transfer goes through an aligned buffer covering whole DISK_DIRECT_ALIGN sectors
+static int DiskDriver_transfer(DiskDriver* disk, void* buf, long offset, long len, int write){
+
+	ssize_t done;
+
+	if(disk->backend_type != DISK_BACKEND_DIRECT) {
+
+		if(write) return pwrite(disk->fd, buf, len, offset) == len ? 0 : -1;
+
+		done = pread(disk->fd, buf, len, offset);
+		if(done < 0) return -1;
+		if(done < len) memset((char*) buf + done, 0, len - done);
+		return 0;
+	}
+
+	// sectors containing the bytes
+	long start = offset - offset % DISK_DIRECT_ALIGN;
+	long end = (offset + len + DISK_DIRECT_ALIGN - 1) / DISK_DIRECT_ALIGN * DISK_DIRECT_ALIGN;
+
+	void* sectors;
+	if(posix_memalign(&sectors, DISK_DIRECT_ALIGN, end - start)) return -1;
+
+	int ret = 0;
+	pthread_mutex_lock(&disk->io_lock);
+
+	done = pread(disk->fd, sectors, end - start, start);
+	if(done < 0) ret = -1;
+	else if(done < end - start) memset((char*) sectors + done, 0, end - start - done);
+
+	if(ret != -1 && write) {
+		memcpy((char*) sectors + (offset - start), buf, len);
+		if(pwrite(disk->fd, sectors, end - start, start) != end - start) ret = -1;
+	}
+	else if(ret != -1) {
+		memcpy(buf, (char*) sectors + (offset - start), len);
+	}
+
+	pthread_mutex_unlock(&disk->io_lock);
+	free(sectors);
+	return ret;
+}
+
+
+// reads header and bitmap in memory, the blocks stay in the file
+static int DiskDriver_preadOpen(DiskDriver* disk, long size){
+
+	void* meta;
+	long meta_alloc = (disk->meta_size + DISK_DIRECT_ALIGN - 1) / DISK_DIRECT_ALIGN * DISK_DIRECT_ALIGN;
+	if(posix_memalign(&meta, DISK_DIRECT_ALIGN, meta_alloc)) return -1;
+
+	disk->header = (DiskHeader*) meta;
+	if(DiskDriver_transfer(disk, meta, 0, disk->meta_size, 0) == -1) {
+		free(meta);
+		disk->header = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static int DiskDriver_preadRead(DiskDriver* disk, void* dest, int block_num){
+
+	return DiskDriver_transfer(disk, dest, DiskDriver_blockOffset(disk, block_num), disk->block_size, 0);
+}
+
+
+static int DiskDriver_preadWrite(DiskDriver* disk, const void* src, int block_num){
+
+	return DiskDriver_transfer(disk, (void*) src, DiskDriver_blockOffset(disk, block_num), disk->block_size, 1);
+}
+
+
+// returns a copy of the block block_num
+static void* DiskDriver_preadGetBlock(DiskDriver* disk, int block_num){
+
+	void* block = malloc(disk->block_size);
+	if(!block) return NULL;
+
+	if(DiskDriver_preadRead(disk, block, block_num) == -1) {
+		free(block);
+		return NULL;
+	}
+	return block;
+}
+
+
+// writes back the copy if asked, and frees it
+static int DiskDriver_preadPutBlock(DiskDriver* disk, void* block, int block_num, int write_back){
+
+	int ret = 0;
+	if(write_back) ret = DiskDriver_preadWrite(disk, block, block_num);
+
+	free(block);
+	return ret;
+}
+
+
+// the blocks are already in the file, only header and bitmap have to be written
+static int DiskDriver_preadSync(DiskDriver* disk, long offset, long len){
+
+	if(offset >= disk->meta_size) return 0;
+	if(offset + len > disk->meta_size) len = disk->meta_size - offset;
+
+	// header and bitmap change under disk->lock, a copy taken under it is written
+	char* copy = (char*) malloc(len);
+	if(!copy) return -1;
+	pthread_mutex_lock(&disk->lock);
+	memcpy(copy, (char*) disk->header + offset, len);
+	pthread_mutex_unlock(&disk->lock);
+
+	int ret = DiskDriver_transfer(disk, copy, offset, len, 1);
+	free(copy);
+	return ret;
+}
+
+
+static int DiskDriver_preadBarrier(DiskDriver* disk){
+
+	return fdatasync(disk->fd);
+}
+
+
+// moves each run of contiguous blocks with a single preadv/pwritev
+// O_DIRECT needs aligned buffers, so it moves a block at a time
+static int DiskDriver_preadSubmit(DiskDriver* disk, DiskIo* ios, int n){
+
+	struct iovec iov[DISK_URING_DEPTH];
+	int i, j, ret = 0;
+
+	for(i = 0; i < n; i = j) {
+
+		// finds the run starting at i
+		for(j = i + 1; j < n && j - i < DISK_URING_DEPTH && disk->backend_type != DISK_BACKEND_DIRECT; j++) {
+			if(ios[j].block_num != ios[j-1].block_num + 1 || ios[j].write != ios[i].write) break;
 		}
 
-		// DiskHeader and bitmap allocation
-		int ret = posix_fallocate(file_descriptor, 0, sizeof(DiskHeader) + num_blocks + num_blocks*BLOCK_SIZE);
-		
-		if(!ret){
-			printf("DiskHeader already allocated\n");
+		int k;
+		for(k = i; k < j; k++) {
+			iov[k - i].iov_base = ios[k].buf;
+			iov[k - i].iov_len = disk->block_size;
 		}
-		
-		disk->fd = file_descriptor;
-		
-		//DiskHeader and bitmap mmapped
-		disk->header = (DiskHeader*) mmap(0, sizeof(DiskHeader) + num_blocks + num_blocks*BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, file_descriptor, 0);
-		
-	}else{ //file doesn't exists
-		//file creation and opening
-		file_descriptor = open(filename, O_CREAT | O_RDWR, 0666);
-
-		if(!file_descriptor) {
-			printf("File opening error");
-			return;
+
+		long len = (long) (j - i) * disk->block_size;
+		long offset = DiskDriver_blockOffset(disk, ios[i].block_num);
+		if(j - i > 1 && (ios[i].write ? pwritev(disk->fd, iov, j - i, offset) : preadv(disk->fd, iov, j - i, offset)) == len) continue;
+
+		// single blocks, and runs not moved at once
+		for(k = i; k < j; k++) {
+			if(ios[k].write && DiskDriver_preadWrite(disk, ios[k].buf, ios[k].block_num) == -1) ret = -1;
+			if(!ios[k].write && DiskDriver_preadRead(disk, ios[k].buf, ios[k].block_num) == -1) ret = -1;
+		}
+	}
+	return ret;
+}
+
+
+static void DiskDriver_preadClose(DiskDriver* disk){
+
+	free(disk->header);
+}
+
+
+static const DiskBackend DiskDriver_preadBackend = {
+	"pread",
+	DiskDriver_preadOpen,
+	DiskDriver_preadRead,
+	DiskDriver_preadWrite,
+	DiskDriver_preadGetBlock,
+	DiskDriver_preadPutBlock,
+	DiskDriver_preadSync,
+	DiskDriver_preadBarrier,
+	DiskDriver_preadSubmit,
+	DiskDriver_preadClose
+};
+
+
+/******************* io_uring engine *******************/
+
+// rings shared with the kernel and blocks written but not yet submitted
+// the flusher thread drains them too, so they are only touched under disk->io_lock
+typedef struct DiskUring {
+  int ring_fd;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe* sqes;
+  struct io_uring_cqe* cqes;
+  void* sq_ring;
+  void* cq_ring;
+  size_t sq_ring_size, cq_ring_size, sqes_size;
+  int num_staged;                             // blocks waiting to be submitted
+  int staged_blocks[DISK_URING_DEPTH];
+  char* staged;                               // their content, DISK_URING_DEPTH blocks
+} DiskUring;
+
+
+// sets up the rings, returns -1 if io_uring isn't available
+static int DiskDriver_uringInit(DiskDriver* disk){
+
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	int ring_fd = (int) syscall(__NR_io_uring_setup, DISK_URING_DEPTH, &params);
+	if(ring_fd < 0) return -1;
+
+	DiskUring* uring = (DiskUring*) calloc(1, sizeof(DiskUring));
+	uring->ring_fd = ring_fd;
+	uring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	uring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	// with IORING_FEAT_SINGLE_MMAP both rings are in the same mapping
+	if(params.features & IORING_FEAT_SINGLE_MMAP) {
+		if(uring->cq_ring_size > uring->sq_ring_size) uring->sq_ring_size = uring->cq_ring_size;
+		uring->cq_ring_size = uring->sq_ring_size;
+	}
+
+	uring->sq_ring = mmap(0, uring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	uring->cq_ring = params.features & IORING_FEAT_SINGLE_MMAP ? uring->sq_ring :
+		mmap(0, uring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+	uring->sqes = (struct io_uring_sqe*) mmap(0, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	uring->staged = (char*) malloc((long) DISK_URING_DEPTH * disk->block_size);
+
+	if(uring->sq_ring == MAP_FAILED || uring->cq_ring == MAP_FAILED || uring->sqes == MAP_FAILED || !uring->staged) {
+		if(uring->sqes != MAP_FAILED) munmap(uring->sqes, uring->sqes_size);
+		if(uring->cq_ring != MAP_FAILED && uring->cq_ring != uring->sq_ring) munmap(uring->cq_ring, uring->cq_ring_size);
+		if(uring->sq_ring != MAP_FAILED) munmap(uring->sq_ring, uring->sq_ring_size);
+		free(uring->staged);
+		free(uring);
+		close(ring_fd);
+		return -1;
+	}
+
+	char* sq = (char*) uring->sq_ring;
+	uring->sq_head = (unsigned*) (sq + params.sq_off.head);
+	uring->sq_tail = (unsigned*) (sq + params.sq_off.tail);
+	uring->sq_mask = (unsigned*) (sq + params.sq_off.ring_mask);
+	uring->sq_array = (unsigned*) (sq + params.sq_off.array);
+
+	char* cq = (char*) uring->cq_ring;
+	uring->cq_head = (unsigned*) (cq + params.cq_off.head);
+	uring->cq_tail = (unsigned*) (cq + params.cq_off.tail);
+	uring->cq_mask = (unsigned*) (cq + params.cq_off.ring_mask);
+	uring->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+
+	disk->uring = uring;
+	return 0;
+}
+
+
+// submits up to DISK_URING_DEPTH transfers with a single io_uring_enter and reaps their completions
+static int DiskDriver_uringRun(DiskDriver* disk, DiskIo* ios, int n){
+
+	DiskUring* uring = disk->uring;
+	unsigned tail = *uring->sq_tail;
+	int i, ret = 0;
+
+	// fills the submission queue
+	for(i = 0; i < n; i++, tail++) {
+		unsigned idx = tail & *uring->sq_mask;
+		struct io_uring_sqe* sqe = &uring->sqes[idx];
+
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = ios[i].write ? IORING_OP_WRITE : IORING_OP_READ;
+		sqe->fd = disk->fd;
+		sqe->addr = (unsigned long) ios[i].buf;
+		sqe->len = disk->block_size;
+		sqe->off = DiskDriver_blockOffset(disk, ios[i].block_num);
+		sqe->user_data = i;
+		uring->sq_array[idx] = idx;
+	}
+	__atomic_store_n(uring->sq_tail, tail, __ATOMIC_RELEASE);
+
+	// submits everything and waits for every completion
+	int submitted = 0, completed = 0;
+	while(completed < n) {
+
+		int done = (int) syscall(__NR_io_uring_enter, uring->ring_fd, n - submitted, n - completed, IORING_ENTER_GETEVENTS, NULL, 0);
+		if(done < 0) {
+			if(errno == EINTR) continue;
+			return -1;
+		}
+		submitted += done;
+
+		// reaps the completions
+		unsigned head = *uring->cq_head;
+		while(head != __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE)) {
+			struct io_uring_cqe* cqe = &uring->cqes[head & *uring->cq_mask];
+			if(cqe->res != disk->block_size) ret = -1;
+			head++;
+			completed++;
+		}
+		__atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	return ret;
+}
+
+
+// submits the written blocks waiting in the staging area, all at once
+static int DiskDriver_uringDrain(DiskDriver* disk){
+
+	DiskUring* uring = disk->uring;
+	if(!uring->num_staged) return 0;
+
+	DiskIo ios[DISK_URING_DEPTH];
+	int i;
+	for(i = 0; i < uring->num_staged; i++) {
+		ios[i].block_num = uring->staged_blocks[i];
+		ios[i].buf = uring->staged + (long) i * disk->block_size;
+		ios[i].write = 1;
+	}
+
+	int ret = DiskDriver_uringRun(disk, ios, uring->num_staged);
+	uring->num_staged = 0;
+	return ret;
+}
+
+
+// returns the staging slot of the block block_num, -1 if not written since the last submission
+static int DiskDriver_uringStaged(DiskDriver* disk, int block_num){
+
+	int i;
+	for(i = 0; i < disk->uring->num_staged; i++) {
+		if(disk->uring->staged_blocks[i] == block_num) return i;
+	}
+	return -1;
+}
+
+
+// moves n blocks in batches of DISK_URING_DEPTH
+// the staged writes are submitted before, so that they are not overtaken
+static int DiskDriver_uringSubmit(DiskDriver* disk, DiskIo* ios, int n){
+
+	pthread_mutex_lock(&disk->io_lock);
+	int ret = DiskDriver_uringDrain(disk);
+	int i;
+	for(i = 0; i < n; i += DISK_URING_DEPTH) {
+		if(DiskDriver_uringRun(disk, ios + i, n - i < DISK_URING_DEPTH ? n - i : DISK_URING_DEPTH) == -1) ret = -1;
+	}
+	pthread_mutex_unlock(&disk->io_lock);
+	return ret;
+}
+
+
+// reads a block, from the staging area if it was just written
+static int DiskDriver_uringRead(DiskDriver* disk, void* dest, int block_num){
+
+	int ret = 0;
+	pthread_mutex_lock(&disk->io_lock);
+	int slot = DiskDriver_uringStaged(disk, block_num);
+	if(slot != -1) memcpy(dest, disk->uring->staged + (long) slot * disk->block_size, disk->block_size);
+	else {
+		DiskIo io = { block_num, dest, 0 };
+		ret = DiskDriver_uringRun(disk, &io, 1);
+	}
+	pthread_mutex_unlock(&disk->io_lock);
+	return ret;
+}
+
+
+// copies the block in the staging area, the writes are submitted together
+// when the area is full or the disk is flushed
+static int DiskDriver_uringWrite(DiskDriver* disk, const void* src, int block_num){
+
+	DiskUring* uring = disk->uring;
+	pthread_mutex_lock(&disk->io_lock);
+
+	// a block written twice is submitted once
+	int slot = DiskDriver_uringStaged(disk, block_num);
+	if(slot == -1) {
+		if(uring->num_staged == DISK_URING_DEPTH && DiskDriver_uringDrain(disk) == -1) {
+			pthread_mutex_unlock(&disk->io_lock);
+			return -1;
 		}
+		slot = uring->num_staged++;
+		uring->staged_blocks[slot] = block_num;
+	}
+
+	memcpy(uring->staged + (long) slot * disk->block_size, src, disk->block_size);
+	pthread_mutex_unlock(&disk->io_lock);
+	return 0;
+}
+
+
+// returns a copy of the block block_num
+static void* DiskDriver_uringGetBlock(DiskDriver* disk, int block_num){
+
+	void* block = malloc(disk->block_size);
+	if(!block) return NULL;
+
+	if(DiskDriver_uringRead(disk, block, block_num) == -1) {
+		free(block);
+		return NULL;
+	}
+	return block;
+}
+
+
+// stages the copy if asked, and frees it
+static int DiskDriver_uringPutBlock(DiskDriver* disk, void* block, int block_num, int write_back){
+
+	int ret = 0;
+	if(write_back) ret = DiskDriver_uringWrite(disk, block, block_num);
+
+	free(block);
+	return ret;
+}
+
+
+// the staged blocks reach the file before it is synchronized
+static int DiskDriver_uringBarrier(DiskDriver* disk){
+
+	pthread_mutex_lock(&disk->io_lock);
+	int ret = DiskDriver_uringDrain(disk);
+	pthread_mutex_unlock(&disk->io_lock);
+	if(fdatasync(disk->fd) == -1) ret = -1;
+	return ret;
+}
+
+
+// releases the rings and the staging area, the staged blocks are lost
+static void DiskDriver_uringFree(DiskDriver* disk){
+
+	DiskUring* uring = disk->uring;
+	munmap(uring->sqes, uring->sqes_size);
+	if(uring->cq_ring != uring->sq_ring) munmap(uring->cq_ring, uring->cq_ring_size);
+	munmap(uring->sq_ring, uring->sq_ring_size);
+	close(uring->ring_fd);
+	free(uring->staged);
+	free(uring);
+	disk->uring = NULL;
+}
 
-		int ret = posix_fallocate(file_descriptor, 0, sizeof(DiskHeader) + num_blocks + num_blocks*BLOCK_SIZE);
 
-		disk->fd=file_descriptor;
+static void DiskDriver_uringClose(DiskDriver* disk){
 
-		disk->header = (DiskHeader*) mmap(0, sizeof(DiskHeader) + num_blocks + num_blocks*BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, file_descriptor, 0);
+	pthread_mutex_lock(&disk->io_lock);
+	DiskDriver_uringDrain(disk);
+	pthread_mutex_unlock(&disk->io_lock);
+
+	DiskDriver_uringFree(disk);
+	DiskDriver_preadClose(disk);
+}
+
+
+// header and bitmap are handled as in the pread engine
+static const DiskBackend DiskDriver_uringBackend = {
+	"io_uring",
+	DiskDriver_preadOpen,
+	DiskDriver_uringRead,
+	DiskDriver_uringWrite,
+	DiskDriver_uringGetBlock,
+	DiskDriver_uringPutBlock,
+	DiskDriver_preadSync,
+	DiskDriver_uringBarrier,
+	DiskDriver_uringSubmit,
+	DiskDriver_uringClose
+};
+
+
+// orders the transfers of a batch by block, and by position in the batch (kept in write) for the same block
+static int DiskDriver_compareIo(const void* a, const void* b){
+
+	const DiskIo* x = (const DiskIo*) a;
+	const DiskIo* y = (const DiskIo*) b;
+	if(x->block_num != y->block_num) return x->block_num < y->block_num ? -1 : 1;
+	return x->write - y->write;
+}
+
+
+// builds the batch of n transfers sorted by block, returns the number of transfers
+// writes of the same block are merged, the last one in block_nums wins
+static int DiskDriver_prepareBatch(DiskIo* ios, const int* block_nums, void** bufs, int n, int write){
+
+	int i, m = 0;
+	for(i = 0; i < n; i++) {
+		ios[i].block_num = block_nums[i];
+		ios[i].buf = bufs[i];
+		ios[i].write = i;      // position in the batch, until sorted
+	}
+
+	// sorts by block, then by position in the batch
+	qsort(ios, n, sizeof(DiskIo), DiskDriver_compareIo);
+
+	for(i = 0; i < n; i++) {
+		if(write && m && ios[m-1].block_num == ios[i].block_num) m--;
+		ios[m] = ios[i];
+		ios[m++].write = write;
+	}
+	return m;
+}
+
+
+// reads the geometry recorded in the header of the image filename
+// returns -1 if the file doesn't start with a valid header
+static int DiskDriver_readHeader(const char* filename, int* num_blocks, int* block_size){
+
+	DiskHeader header;
+	int fd = open(filename, O_RDONLY);
+	if(fd == -1) return -1;
+
+	ssize_t done = pread(fd, &header, sizeof(DiskHeader), 0);
+	close(fd);
+
+	if(done != sizeof(DiskHeader) || header.magic != DISK_MAGIC || header.num_blocks <= 0) return -1;
+
+	*num_blocks = header.num_blocks;
+	*block_size = header.block_size;
+	return 0;
+}
+
+
+void DiskDriver_init(DiskDriver* disk, const char* filename, int num_blocks){
+
+	DiskDriver_initBackend(disk, filename, num_blocks, DISK_DEFAULT_BLOCK_SIZE, DISK_BACKEND_MMAP);
+}
+
+
+// opens the image filename moving the blocks with the engine backend, or creates it again empty with format set
+static void DiskDriver_open(DiskDriver* disk, const char* filename, int num_blocks, int block_size, DiskBackendType backend, int format){
+	
+	int file_descriptor;
+	int exists = !format && !access(filename, F_OK);
+	int flags = exists ? O_RDWR : O_CREAT | O_RDWR | O_TRUNC;
+	
+	// an existing image keeps its geometry, the header is read before choosing the size of the mapping
+	// a file that isn't an image is left untouched
+	if(exists && DiskDriver_readHeader(filename, &num_blocks, &block_size) == -1) {
+		printf("Disk header not recognized, the disk is not opened\n");
+		disk->header = NULL;
+		return;
+	}
+	
+	// security check on block size, a power of 2 in range
+	if(block_size < DISK_MIN_BLOCK_SIZE || block_size > DISK_MAX_BLOCK_SIZE || (block_size & (block_size - 1))) {
+		printf("Invalid block size %d\n", block_size);
+		disk->header = NULL;
+		return;
+	}
+	disk->block_size = block_size;
+	
+	file_descriptor = open(filename, backend == DISK_BACKEND_DIRECT ? flags | O_DIRECT : flags, 0666);
+	
+	// not every file system supports O_DIRECT
+	if(file_descriptor == -1 && backend == DISK_BACKEND_DIRECT) {
+		printf("O_DIRECT not supported, using pread/pwrite\n");
+		backend = DISK_BACKEND_PREAD;
+		file_descriptor = open(filename, flags, 0666);
+	}
+	
+	if(file_descriptor == -1) {
+		printf("File opening error\n");
+		disk->header = NULL;
+		return;
+	}
+	
+	// io_uring can be missing or forbidden in the kernel
+	disk->uring = NULL;
+	if(backend == DISK_BACKEND_URING && DiskDriver_uringInit(disk) == -1) {
+		printf("io_uring not available, using pread/pwrite\n");
+		backend = DISK_BACKEND_PREAD;
+	}
+	
+	// DiskHeader, bitmap and blocks allocation, whole sectors with O_DIRECT
+	long size = sizeof(DiskHeader) + num_blocks + (long) num_blocks*disk->block_size;
+	long alloc_size = backend == DISK_BACKEND_DIRECT ? (size + DISK_DIRECT_ALIGN - 1) / DISK_DIRECT_ALIGN * DISK_DIRECT_ALIGN : size;
+	int ret = posix_fallocate(file_descriptor, 0, alloc_size);
+	
+	if(exists && !ret){
+		printf("DiskHeader already allocated\n");
+	}
+	
+	disk->fd = file_descriptor;
+	disk->backend_type = backend;
+	disk->backend = backend == DISK_BACKEND_MMAP ? &DiskDriver_mmapBackend :
+		backend == DISK_BACKEND_URING ? &DiskDriver_uringBackend : &DiskDriver_preadBackend;
+	disk->meta_size = sizeof(DiskHeader) + num_blocks;
+	pthread_mutex_init(&disk->io_lock, NULL);
+	
+	//DiskHeader and bitmap mmapped or read
+	if(disk->backend->open(disk, size) == -1) {
+		printf("Disk opening error with backend %s\n", disk->backend->name);
+		if(disk->uring) DiskDriver_uringFree(disk);
+		pthread_mutex_destroy(&disk->io_lock);
+		close(file_descriptor);
+		disk->header = NULL;
+		return;
+	}
+	
+	if(!exists) {
 		disk->header->num_blocks = num_blocks;
 		disk->header->free_blocks = num_blocks;
-		
+		disk->header->block_size = block_size;
+		disk->header->magic = DISK_MAGIC;
+		disk->header->reclaim_count = 0;
+		disk->header->reclaim_stamps = 0;
 	}
 	
 	lseek(file_descriptor, 0, SEEK_SET);
 	
+	// every change is synchronized by default
+	disk->sync_mode = DISK_SYNC_EVERY_OP;
+	disk->flush_interval = 0;
+	disk->flusher_running = 0;
+	pthread_mutex_init(&disk->lock, NULL);
+	pthread_cond_init(&disk->wakeup, NULL);
+	
 	// bitmap initialization
+	// the summary of the bitmap is rebuilt in memory from the bitmap on disk
 	disk->map = (BitMap*) malloc(sizeof(BitMap)); 
-	disk->map->entries = (char *) disk->header + sizeof(DiskHeader);
-	disk->map->num_bits = num_blocks;
+	BitMap_init(disk->map, num_blocks, (char *) disk->header + sizeof(DiskHeader));
 	
+	// no page is dirty, the dirty pages are found scanning, so the summary isn't needed
+	disk->page_size = sysconf(_SC_PAGESIZE);
+	int num_pages = (DiskDriver_size(disk) + disk->page_size - 1) / disk->page_size;
+	disk->dirty = (BitMap*) malloc(sizeof(BitMap));
+	BitMap_init(disk->dirty, num_pages, (char*) calloc((num_pages + 7) / 8, sizeof(char)));
+	BitMap_freeSummary(disk->dirty);
+
+	// checks the free blocks counter against the bitmap
+	int free_blocks = BitMap_count(disk->map, 0);
+	if(disk->header->free_blocks != free_blocks) {
+		printf("Free blocks counter was %d, the bitmap has %d free blocks\n", disk->header->free_blocks, free_blocks);
+		disk->header->free_blocks = free_blocks;
+	}
+
 	// sets disk->header->first_free_block and tests the disk driver correct initialization
 	disk->header->first_free_block = DiskDriver_getFreeBlock(disk,0);
 	
+	// a new header has to reach the file whatever the backend
+	if(!exists) {
+		pthread_mutex_lock(&disk->lock);
+		DiskDriver_markRange(disk, 0, disk->meta_size);
+		pthread_mutex_unlock(&disk->lock);
+		DiskDriver_flush(disk);
+	}
+	
 	return;
 }
 
 
+// same as DiskDriver_init, moving the blocks with the engine backend
+void DiskDriver_initBackend(DiskDriver* disk, const char* filename, int num_blocks, int block_size, DiskBackendType backend){
+
+	DiskDriver_open(disk, filename, num_blocks, block_size, backend, 0);
+}
+
+
+// creates the image filename again, empty, whatever the file held
+void DiskDriver_format(DiskDriver* disk, const char* filename, int num_blocks, int block_size, DiskBackendType backend){
+
+	DiskDriver_open(disk, filename, num_blocks, block_size, backend, 1);
+}
+
+
 // reads the block in position block_num and returns -1 if the block is free according to the bitmap, 0 otherwise
 int DiskDriver_readBlock(DiskDriver* disk, void* dest, int block_num){
 	
@@ -83,10 +921,7 @@ int DiskDriver_readBlock(DiskDriver* disk, void* dest, int block_num){
 	if(BitMap_get(disk->map, block_num, 0) == block_num) return -1;
 	
 	// inserts in dest the block block_num
-	memcpy(dest, disk->map->entries + disk->header->num_blocks + (block_num * BLOCK_SIZE), BLOCK_SIZE);
-
-	// function ends returning 0
-	return 0;
+	return disk->backend->read(disk, dest, block_num);
 }
 
 
@@ -97,24 +932,118 @@ int DiskDriver_writeBlock(DiskDriver* disk, void* src, int block_num){
 	// security check on disk size
 	if(block_num >= disk->header->num_blocks || block_num < 0) return -1;
 	
-	//security check on source size
-	if(strlen(src) * 8 > BLOCK_SIZE) return -1;
-	
-	// decreases the number of free blocks in the disk header
-	if(BitMap_get(disk->map,block_num,0) == block_num) disk->header->free_blocks--;
+	// inserts or overwites src in the block block_num
+	if(disk->backend->write(disk, src, block_num) == -1) return -1;
+
+	return DiskDriver_allocate(disk, &block_num, 1);
+}
+
+
+// reads the n blocks in block_nums, the block block_nums[i] in bufs[i]
+// returns -1 if a block is out of range or free according to the bitmap (nothing is read), 0 otherwise
+int DiskDriver_readBlocks(DiskDriver* disk, const int* block_nums, void** bufs, int n){
+
+	// security check on input args
+	if(!block_nums || !bufs || n < 0) return -1;
+
+	int i;
+	for(i = 0; i < n; i++) {
+		if(block_nums[i] >= disk->header->num_blocks || block_nums[i] < 0) return -1;
+		if(BitMap_get(disk->map, block_nums[i], 0) == block_nums[i]) return -1;
+	}
+	if(!n) return 0;
+
+	DiskIo* ios = (DiskIo*) malloc(n * sizeof(DiskIo));
+	if(!ios) return -1;
+
+	// contiguous blocks are read together
+	int m = DiskDriver_prepareBatch(ios, block_nums, bufs, n, 0);
+	int ret = disk->backend->submit(disk, ios, m);
+
+	free(ios);
+	return ret;
+}
+
+
+// writes the n blocks in block_nums, bufs[i] in the block block_nums[i]
+// the bitmap is altered and the sync mode applied once for the whole batch
+// returns -1 if a block is out of range (nothing is written) or the operation not possible
+int DiskDriver_writeBlocks(DiskDriver* disk, const int* block_nums, void** bufs, int n){
+
+	// security check on input args
+	if(!block_nums || !bufs || n < 0) return -1;
+
+	int i;
+	for(i = 0; i < n; i++) {
+		if(block_nums[i] >= disk->header->num_blocks || block_nums[i] < 0) return -1;
+	}
+	if(!n) return 0;
+
+	DiskIo* ios = (DiskIo*) malloc(n * sizeof(DiskIo));
+	int* written = (int*) malloc(n * sizeof(int));
+	if(!ios || !written) {
+		free(ios);
+		free(written);
+		return -1;
+	}
+
+	// contiguous blocks are written together, a block written twice only once
+	int m = DiskDriver_prepareBatch(ios, block_nums, bufs, n, 1);
+	int ret = disk->backend->submit(disk, ios, m);
+
+	if(ret != -1) {
+		for(i = 0; i < m; i++) written[i] = ios[i].block_num;
+		ret = DiskDriver_allocate(disk, written, m);
+	}
+
+	free(ios);
+	free(written);
+	return ret;
+}
+
+
+// returns a pointer to the block block_num, without copying it if the backend maps the image
+// NULL if the block is free according to the bitmap or out of range
+const void* DiskDriver_getBlock(DiskDriver* disk, int block_num){
+
+	// security check on disk size
+	if(block_num >= disk->header->num_blocks || block_num < 0) return NULL;
 	
-	BitMap_set(disk->map, block_num, 1);
+	// check in the bitmap if block_num is free
+	if(BitMap_get(disk->map, block_num, 0) == block_num) return NULL;
 
-	// inserts or overwites src in the block block_num
-	memcpy(disk->map->entries + disk->header->num_blocks + (block_num * BLOCK_SIZE), src, BLOCK_SIZE);
+	return disk->backend->getBlock(disk, block_num);
+}
 
-	// synchronizes mmapped memory
-	if(DiskDriver_flush(disk) == -1) return -1;
 
-	// updates the first free block position in the disk header if changed
-	disk->header->first_free_block = DiskDriver_getFreeBlock(disk,0);		
+// releases a block returned by DiskDriver_getBlock
+void DiskDriver_putBlock(DiskDriver* disk, const void* block){
 
-  return 0;	
+	if(block) disk->backend->putBlock(disk, (void*) block, -1, 0);
+}
+
+
+// returns a writable pointer to the block block_num, even if free
+// NULL if out of range
+void* DiskDriver_pinBlock(DiskDriver* disk, int block_num){
+
+	// security check on disk size
+	if(block_num >= disk->header->num_blocks || block_num < 0) return NULL;
+
+	return disk->backend->getBlock(disk, block_num);
+}
+
+
+// commits the changes made to the block block_num, and alters the bitmap accordingly
+// returns -1 if operation not possible
+int DiskDriver_commitBlock(DiskDriver* disk, void* block, int block_num){
+
+	// security check on disk size
+	if(!block || block_num >= disk->header->num_blocks || block_num < 0) return -1;
+
+	if(disk->backend->putBlock(disk, block, block_num, 1) == -1) return -1;
+	
+	return DiskDriver_allocate(disk, &block_num, 1);
 }
 
 
@@ -122,20 +1051,53 @@ int DiskDriver_writeBlock(DiskDriver* disk, void* src, int block_num){
 // returns -1 if operation not possible
 int DiskDriver_freeBlock(DiskDriver* disk, int block_num){
 	
-	// security check on disk size
-	if(block_num >= disk->header->num_blocks || block_num < 0) return -1;
+	return DiskDriver_freeBlocks(disk, &block_num, 1);
+}
 
-	// increases the number of free blocks in the disk header
-	if(DiskDriver_getFreeBlock(disk,block_num-1) != block_num) disk->header->free_blocks++;
-	
-	BitMap_set(disk->map, block_num, 0);
+
+// frees the n blocks in block_nums, and alters the bitmap accordingly
+// returns -1 if a block is out of range (nothing is freed) or the operation not possible
+int DiskDriver_freeBlocks(DiskDriver* disk, const int* block_nums, int n){
+
+	// security check on input args
+	if(!block_nums || n < 0) return -1;
+
+	int i, sorted = 1;
+	for(i = 0; i < n; i++) {
+		if(block_nums[i] >= disk->header->num_blocks || block_nums[i] < 0) return -1;
+		if(i > 0 && block_nums[i] < block_nums[i-1]) sorted = 0;
+	}
+
+	// the flusher reads the changed range of the bitmap under disk->lock
+	pthread_mutex_lock(&disk->lock);
+
+	// sorted blocks are cleared a bitmap word at a time
+	if(sorted && n > 0) {
+		disk->header->free_blocks += BitMap_clearSorted(disk->map, block_nums, n);
+		if(block_nums[0] < disk->header->first_free_block || disk->header->first_free_block == -1)
+			disk->header->first_free_block = block_nums[0];
+	}
+
+	for(i = 0; i < n && !sorted; i++) {
+
+		// if the block was used
+		if(BitMap_get(disk->map,block_nums[i],0) != block_nums[i]) {
+
+			// increases the number of free blocks in the disk header
+			disk->header->free_blocks++;
+			BitMap_set(disk->map, block_nums[i], 0);
+
+			// updates the first free block position in the disk header if changed
+			if(block_nums[i] < disk->header->first_free_block || disk->header->first_free_block == -1) 
+				disk->header->first_free_block = block_nums[i];
+		}
+	}
+	pthread_mutex_unlock(&disk->lock);
+
+	DiskDriver_markDirty(disk, NULL, 0);
 	
 	// synchronizes mmapped memory
-	if(DiskDriver_flush(disk) == -1) return -1;
-
-	// updates the first free block position in the disk header if changed
-	if(block_num < disk->header->first_free_block) 
-		disk->header->first_free_block = block_num;
+	if(DiskDriver_opSync(disk) == -1) return -1;
 
 	return 0;
 }
@@ -155,14 +1117,179 @@ int DiskDriver_getFreeBlock(DiskDriver* disk, int start){
 }
 
 
+// returns the first block, from position start, of a run of len free blocks (checking the bitmap)
+int DiskDriver_getFreeRun(DiskDriver* disk, int start, int len){
+
+	// security check on disk size
+	if(start >= disk->header->num_blocks || start < 0) return -1;
+
+	return BitMap_getRun(disk->map, start, len, 0);
+}
+
+
+// returns the number of consecutive free blocks from position start, at most max
+int DiskDriver_getFreeLength(DiskDriver* disk, int start, int max){
+
+	// security check on disk size
+	if(start >= disk->header->num_blocks || start < 0) return 0;
+
+	return BitMap_runLength(disk->map, start, max, 0);
+}
+
+
+// marks the n blocks from position start as used without writing them
+// returns -1 if a block is out of range or not free (nothing is reserved)
+int DiskDriver_reserveBlocks(DiskDriver* disk, int start, int n){
+
+	// security check on input args
+	if(start < 0 || n <= 0 || start + n > disk->header->num_blocks) return -1;
+	if(DiskDriver_getFreeLength(disk, start, n) != n) return -1;
+
+	int i;
+	pthread_mutex_lock(&disk->lock);
+	for(i = 0; i < n; i++) {
+		BitMap_set(disk->map, start + i, 1);
+	}
+	disk->header->free_blocks -= n;
+
+	// the first free block can only be after the run, if it was taken
+	if(disk->header->first_free_block >= start && disk->header->first_free_block < start + n)
+		disk->header->first_free_block = start + n < disk->header->num_blocks ? DiskDriver_getFreeBlock(disk, start + n) : -1;
+	pthread_mutex_unlock(&disk->lock);
+
+	DiskDriver_markDirty(disk, NULL, 0);
+
+	// synchronizes mmapped memory
+	if(DiskDriver_opSync(disk) == -1) return -1;
+
+	return 0;
+}
+
+
+// appends block_num to the reclaim queue of the header
+int DiskDriver_queueReclaim(DiskDriver* disk, int block_num){
+
+	// security check on input args
+	if(block_num < 0 || block_num >= disk->header->num_blocks) return -1;
+	if(disk->header->reclaim_count == DISK_RECLAIM_SLOTS) return -1;
+
+	// the header changes under disk->lock, as the bitmap
+	int stamp = DiskDriver_nextReclaimStamp(disk);
+	pthread_mutex_lock(&disk->lock);
+	disk->header->reclaim_stamps = stamp;
+	disk->header->reclaim[disk->header->reclaim_count] = block_num;
+	disk->header->reclaim_stamp[disk->header->reclaim_count++] = stamp;
+	pthread_mutex_unlock(&disk->lock);
+	DiskDriver_markHeader(disk);
+
+	// synchronizes mmapped memory
+	if(DiskDriver_opSync(disk) == -1) return -1;
+
+	return stamp;
+}
+
+
+// the stamps start again from 1 when they run out
+int DiskDriver_nextReclaimStamp(DiskDriver* disk){
+
+	return disk->header->reclaim_stamps < INT_MAX ? disk->header->reclaim_stamps + 1 : 1;
+}
+
+
+// takes the oldest block out of the reclaim queue, without synchronizing the header
+int DiskDriver_dequeueReclaim(DiskDriver* disk){
+
+	if(disk->header->reclaim_count == 0) return -1;
+
+	int block_num = disk->header->reclaim[0];
+	pthread_mutex_lock(&disk->lock);
+	disk->header->reclaim_count--;
+	memmove(disk->header->reclaim, disk->header->reclaim + 1, disk->header->reclaim_count * sizeof(int));
+	memmove(disk->header->reclaim_stamp, disk->header->reclaim_stamp + 1, disk->header->reclaim_count * sizeof(int));
+	pthread_mutex_unlock(&disk->lock);
+	DiskDriver_markHeader(disk);
+
+	return block_num;
+}
+
+
 // writes the data (flushing the mmaps)
+// only the dirty pages are synchronized, one backend sync (msync) for each run of contiguous pages
 int DiskDriver_flush(DiskDriver* disk){
 	
-	// size of the memory to be synchronized
-	int mem_size = sizeof(DiskHeader) + (disk->header->num_blocks) + (disk->header->num_blocks*BLOCK_SIZE);
+	int num_entries = (disk->dirty->num_bits + 7) / 8;
+	char* entries = (char*) malloc(num_entries);
+	if(!entries) return -1;
+
+	// takes the dirty pages, the ones changed from now on go to the next flush
+	pthread_mutex_lock(&disk->lock);
+	DiskDriver_markBitmap(disk);
+	memcpy(entries, disk->dirty->entries, num_entries);
+	memset(disk->dirty->entries, 0, num_entries);
+	pthread_mutex_unlock(&disk->lock);
+
+	BitMap pages = { .num_bits = disk->dirty->num_bits, .entries = entries, .summary = NULL, .top = NULL };
+
+	long mem_size = DiskDriver_size(disk);
+	int ret = 0, synced = 0;
+
+	// synchronizes the runs of dirty pages in order of offset
+	int start = BitMap_get(&pages, 0, 1);
+	while(start != -1) {
+
+		int end = BitMap_get(&pages, start, 0);
+		if(end == -1) end = pages.num_bits;
+
+		long offset = (long) start * disk->page_size;
+		long len = (long) (end - start) * disk->page_size;
+		if(offset + len > mem_size) len = mem_size - offset;
 
-	// synchronizes to mmap memory
-	return msync(disk->header, mem_size, MS_SYNC);
+		if(disk->backend->sync(disk, offset, len) == -1) ret = -1;
+		synced = 1;
+
+		start = end < pages.num_bits ? BitMap_get(&pages, end, 1) : -1;
+	}
+
+	if(synced && disk->backend->barrier(disk) == -1) ret = -1;
+
+	free(entries);
+	return ret;
+}
+
+
+// sets when the changes are synchronized with the file
+int DiskDriver_setSyncMode(DiskDriver* disk, DiskSyncMode mode, int interval){
+
+	// security check on input args
+	if(!disk || mode < DISK_SYNC_EVERY_OP || mode > DISK_SYNC_EXPLICIT) return -1;
+	if(mode == DISK_SYNC_TIMED && interval <= 0) return -1;
+
+	DiskDriver_stopFlusher(disk);
+
+	// nothing changed before has to be lost by the new mode
+	DiskDriver_flush(disk);
+
+	disk->sync_mode = mode;
+	disk->flush_interval = interval;
+
+	if(mode == DISK_SYNC_TIMED) {
+		disk->flusher_running = 1;
+		if(pthread_create(&disk->flusher, NULL, DiskDriver_flusher, disk) != 0) {
+			disk->flusher_running = 0;
+			disk->sync_mode = DISK_SYNC_EVERY_OP;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+// ends a file system operation, flushing in DISK_SYNC_EVERY_OP and DISK_SYNC_FS_OP modes
+int DiskDriver_sync(DiskDriver* disk){
+
+	if(disk->sync_mode != DISK_SYNC_EVERY_OP && disk->sync_mode != DISK_SYNC_FS_OP) return 0;
+	return DiskDriver_flush(disk);
 }
 
 
@@ -170,9 +1297,20 @@ int DiskDriver_flush(DiskDriver* disk){
 int DiskDriver_destroy(DiskDriver* disk){
 	
 	// size of the memory to be freed
-	int mem_size = sizeof(DiskHeader) + (disk->header->num_blocks) + (disk->header->num_blocks*BLOCK_SIZE);
+	long mem_size = DiskDriver_size(disk);
 	
+	// the pending changes are written whatever the sync mode
+	DiskDriver_stopFlusher(disk);
+	DiskDriver_flush(disk);
+	pthread_mutex_destroy(&disk->lock);
+	BitMap_destroy(disk->dirty);
+	pthread_cond_destroy(&disk->wakeup);
+	BitMap_freeSummary(disk->map);
+	disk->backend->close(disk);
+	pthread_mutex_destroy(&disk->io_lock);
+
 	ftruncate(disk->fd, mem_size);
+	close(disk->fd);
 	free(disk->map);
 	free(disk);
 	return 0;
@@ -1,17 +1,100 @@
 #pragma once
 #include "bitmap.h"
-#define BLOCK_SIZE 512
+#include <pthread.h>
+// default block size, the block size of a disk is chosen when the image is created
+#define DISK_DEFAULT_BLOCK_SIZE 512
+#define DISK_MIN_BLOCK_SIZE 512
+#define DISK_MAX_BLOCK_SIZE 65536
+
+// identifies the images with this layout of header and blocks
+#define DISK_MAGIC 0x53465337
+
+// entries of the reclaim queue of the header
+#define DISK_RECLAIM_SLOTS 32
+
 // this is stored in the 1st block of the disk
 typedef struct {
   int num_blocks;
   int free_blocks;     // free blocks
   int first_free_block;// first block index
+  int block_size;      // bytes of each block, a power of 2 from DISK_MIN_BLOCK_SIZE to DISK_MAX_BLOCK_SIZE
+  int magic;           // DISK_MAGIC
+  int reclaim_count;   // entries of reclaim in use
+  int reclaim_stamps;  // last stamp given to an entry of reclaim
+  int reclaim[DISK_RECLAIM_SLOTS]; // first blocks of the removed files whose blocks are still to be freed, oldest first
+  int reclaim_stamp[DISK_RECLAIM_SLOTS]; // stamp of each entry, the file system records it in the removed file too
 } DiskHeader; 
 
+// when the changes to the mmapped image are synchronized with the file
+typedef enum {
+  DISK_SYNC_EVERY_OP = 0, // after every block written or freed
+  DISK_SYNC_FS_OP,        // once at the end of every file system operation
+  DISK_SYNC_TIMED,        // by a background thread, every flush_interval milliseconds
+  DISK_SYNC_EXPLICIT      // only when DiskDriver_flush is called
+} DiskSyncMode;
+
+// the engines moving the blocks between memory and the file
+typedef enum {
+  DISK_BACKEND_MMAP = 0,  // the whole image is mapped with MAP_SHARED
+  DISK_BACKEND_PREAD,     // header and bitmap are kept in memory, the blocks are moved with pread/pwrite
+  DISK_BACKEND_DIRECT,    // like DISK_BACKEND_PREAD, with O_DIRECT and aligned buffers
+  DISK_BACKEND_URING      // like DISK_BACKEND_PREAD, the blocks are moved in batches through io_uring
+} DiskBackendType;
+
+// alignment of the O_DIRECT transfers
+#define DISK_DIRECT_ALIGN 4096
+
+// blocks written and not yet submitted, and blocks submitted at once, by the io_uring engine
+#define DISK_URING_DEPTH 64
+
+struct DiskDriver;
+struct DiskUring;
+
+// a block transfer of a batch
 typedef struct {
-  DiskHeader* header; // mmapped
+  int block_num;
+  void* buf;
+  int write;           // 1 writes buf in the block, 0 reads the block in buf
+} DiskIo;
+
+// operations of an engine, the offsets are in bytes from the start of the image
+typedef struct {
+  const char* name;
+  // makes header and bitmap (the first meta_size bytes of the image of size size) available in disk->header
+  int   (*open)(struct DiskDriver* disk, long size);
+  int   (*read)(struct DiskDriver* disk, void* dest, int block_num);
+  int   (*write)(struct DiskDriver* disk, const void* src, int block_num);
+  // returns the block block_num, in place if the engine can
+  void* (*getBlock)(struct DiskDriver* disk, int block_num);
+  // releases a block returned by getBlock, writing it back in position block_num if write_back
+  int   (*putBlock)(struct DiskDriver* disk, void* block, int block_num, int write_back);
+  // writes the bytes [offset, offset+len) of the image to the file
+  int   (*sync)(struct DiskDriver* disk, long offset, long len);
+  // makes the synchronized bytes durable
+  int   (*barrier)(struct DiskDriver* disk);
+  // moves n blocks at once, returns when every transfer is done
+  int   (*submit)(struct DiskDriver* disk, DiskIo* ios, int n);
+  void  (*close)(struct DiskDriver* disk);
+} DiskBackend;
+
+typedef struct DiskDriver {
+  DiskHeader* header; // mmapped, or in memory if the backend can't map
   BitMap* map;
   int fd; // for us
+  int block_size;            // copy of header->block_size, known before the header is loaded
+  const DiskBackend* backend;
+  DiskBackendType backend_type;
+  long meta_size;            // size of header and bitmap
+  pthread_mutex_t io_lock;   // serializes the read-modify-write cycles of O_DIRECT and the io_uring staging
+  struct DiskUring* uring;   // state of the io_uring engine
+  DiskSyncMode sync_mode;
+  int flush_interval;        // milliseconds between two flushes in DISK_SYNC_TIMED mode
+  BitMap* dirty;             // a bit for each page of the image, set if changed since the last flush
+  long page_size;
+  pthread_mutex_t lock;      // protects the dirty pages
+  pthread_cond_t wakeup;     // wakes up the flusher thread
+  pthread_t flusher;         // background flusher (DISK_SYNC_TIMED only)
+  int flusher_running;
 } DiskDriver;
 
 /**
@@ -27,6 +110,18 @@ typedef struct {
 // with all 0 (to denote the free space);
 void DiskDriver_init(DiskDriver* disk, const char* filename, int num_blocks);
 
+// same as DiskDriver_init, with blocks of block_size bytes moved by the engine backend
+// an existing image keeps the number and size of blocks recorded in its header,
+// a file without a valid header is not opened (disk->header is NULL), DiskDriver_format must be asked for
+// DISK_BACKEND_DIRECT falls back to DISK_BACKEND_PREAD if the file system doesn't support O_DIRECT
+// DISK_BACKEND_URING falls back to DISK_BACKEND_PREAD if the kernel doesn't provide io_uring
+void DiskDriver_initBackend(DiskDriver* disk, const char* filename, int num_blocks, int block_size, DiskBackendType backend);
+
+// creates the image filename again, empty, with num_blocks blocks of block_size bytes
+// whatever the file held is lost
+// disk->header is NULL on error
+void DiskDriver_format(DiskDriver* disk, const char* filename, int num_blocks, int block_size, DiskBackendType backend);
+
 // reads the block in position block_num
 // returns -1 if the block is free accrding to the bitmap
 // 0 otherwise
@@ -36,15 +131,84 @@ int DiskDriver_readBlock(DiskDriver* disk, void* dest, int block_num);
 // returns -1 if operation not possible
 int DiskDriver_writeBlock(DiskDriver* disk, void* src, int block_num);
 
+// reads the n blocks in block_nums, the block block_nums[i] in bufs[i]
+// contiguous blocks are read together
+// returns -1 if a block is out of range or free according to the bitmap (nothing is read), 0 otherwise
+int DiskDriver_readBlocks(DiskDriver* disk, const int* block_nums, void** bufs, int n);
+
+// writes the n blocks in block_nums, bufs[i] in the block block_nums[i]
+// contiguous blocks are written together, the bitmap is altered once for the whole batch
+// returns -1 if operation not possible
+int DiskDriver_writeBlocks(DiskDriver* disk, const int* block_nums, void** bufs, int n);
+
+// returns a pointer to the block in position block_num inside the disk, without copying it
+// NULL if the block is free according to the bitmap or out of range
+// the block must not be changed through the pointer, and is released by DiskDriver_putBlock
+const void* DiskDriver_getBlock(DiskDriver* disk, int block_num);
+
+// releases a block returned by DiskDriver_getBlock
+void DiskDriver_putBlock(DiskDriver* disk, const void* block);
+
+// returns a writable pointer to the block in position block_num inside the disk (NULL if out of range)
+// the changes are applied by DiskDriver_commitBlock
+void* DiskDriver_pinBlock(DiskDriver* disk, int block_num);
+
+// commits the changes made to a block returned by DiskDriver_pinBlock, and alters the bitmap accordingly
+// the block can't be used anymore after the call
+// returns -1 if operation not possible
+int DiskDriver_commitBlock(DiskDriver* disk, void* block, int block_num);
+
 // frees a block in position block_num, and alters the bitmap accordingly
 // returns -1 if operation not possible
 int DiskDriver_freeBlock(DiskDriver* disk, int block_num);
 
+// frees the n blocks in block_nums, and alters the bitmap once for the whole batch
+// blocks sorted in increasing order are cleared a bitmap word at a time
+// returns -1 if operation not possible
+int DiskDriver_freeBlocks(DiskDriver* disk, const int* block_nums, int n);
+
 // returns the first free block in the disk from position (checking the bitmap)
 int DiskDriver_getFreeBlock(DiskDriver* disk, int start);
 
+// returns the first block, from position start, of a run of len free blocks (checking the bitmap)
+// -1 if there is no such run
+int DiskDriver_getFreeRun(DiskDriver* disk, int start, int len);
+
+// returns the number of consecutive free blocks from position start, at most max
+int DiskDriver_getFreeLength(DiskDriver* disk, int start, int max);
+
+// marks the n blocks from position start as used without writing them, and alters the bitmap accordingly
+// the blocks are freed by DiskDriver_freeBlocks as any other block
+// returns -1 if a block is out of range or not free (nothing is reserved)
+int DiskDriver_reserveBlocks(DiskDriver* disk, int start, int n);
+
+// appends block_num to the reclaim queue of the header, with a new stamp
+// the blocks of a removed file stay used until the file system frees them and takes it out of the queue
+// the stamp tells whether block_num still holds the removed file when the entry is reclaimed
+// returns the stamp (> 0), -1 if the queue is full
+int DiskDriver_queueReclaim(DiskDriver* disk, int block_num);
+
+// returns the stamp the next entry of the reclaim queue gets, to be recorded before it is queued
+int DiskDriver_nextReclaimStamp(DiskDriver* disk);
+
+// takes the oldest block out of the reclaim queue
+// the header is synchronized by the following operation, the DiskDriver_freeBlocks of the blocks it stood for,
+// so that the entry never outlives its blocks
+// returns the block, -1 if the queue is empty
+int DiskDriver_dequeueReclaim(DiskDriver* disk);
+
 // writes the data (flushing the mmaps)
+// only the pages changed since the last flush are synchronized, one msync for each run of pages
 int DiskDriver_flush(DiskDriver* disk);
 
+// sets when the changes are synchronized with the file (DISK_SYNC_EVERY_OP by default)
+// interval is the time in milliseconds between two flushes in DISK_SYNC_TIMED mode
+// returns -1 if the mode can't be set
+int DiskDriver_setSyncMode(DiskDriver* disk, DiskSyncMode mode, int interval);
+
+// ends a file system operation, flushing the changes
+// in DISK_SYNC_EVERY_OP and DISK_SYNC_FS_OP modes
+int DiskDriver_sync(DiskDriver* disk);
+
 // frees disk driver resources
 int DiskDriver_destroy(DiskDriver* disk);
@@ -7,6 +7,149 @@
 #include <unistd.h> 
 #include <stdlib.h>
 
+// hash of a name in the hash tables of the directories and in the dentry cache (FNV-1a)
+static unsigned int SimpleFS_hash(const char* name){
+
+	unsigned int hash = 2166136261u;
+	while(*name) {
+		hash ^= (unsigned char) *name++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+
+// empties the dentry cache, every entry goes in the LRU list
+static void SimpleFS_dcacheInit(DentryCache* cache){
+
+	int i;
+	for(i = 0; i < SIMPLEFS_DCACHE_BUCKETS; i++) cache->buckets[i] = -1;
+	for(i = 0; i < SIMPLEFS_DCACHE_SIZE; i++) {
+		cache->entries[i].dir_block = -1;
+		cache->entries[i].next_hash = -1;
+		cache->entries[i].prev_lru = i - 1;
+		cache->entries[i].next_lru = i + 1 < SIMPLEFS_DCACHE_SIZE ? i + 1 : -1;
+	}
+	cache->lru_first = 0;
+	cache->lru_last = SIMPLEFS_DCACHE_SIZE - 1;
+	cache->hits = 0;
+	cache->misses = 0;
+}
+
+
+// bucket of the name with hash "hash" in the directory dir_block
+static int SimpleFS_dcacheBucket(int dir_block, unsigned int hash, int is_dir){
+
+	return (hash ^ (unsigned int) dir_block * 2654435761u ^ is_dir) % SIMPLEFS_DCACHE_BUCKETS;
+}
+
+
+// returns the entry of name in the directory dir_block, -1 if not cached
+static int SimpleFS_dcacheFind(DentryCache* cache, int dir_block, const char* name, unsigned int hash, int is_dir){
+
+	int i = cache->buckets[SimpleFS_dcacheBucket(dir_block, hash, is_dir)];
+	while(i != -1) {
+		Dentry* entry = &cache->entries[i];
+		if(entry->dir_block == dir_block && entry->hash == hash && entry->is_dir == is_dir && strcmp(entry->name, name) == 0) return i;
+		i = entry->next_hash;
+	}
+	return -1;
+}
+
+
+// moves the entry i at the head of the LRU list
+static void SimpleFS_dcacheTouch(DentryCache* cache, int i){
+
+	Dentry* entry = &cache->entries[i];
+	if(cache->lru_first == i) return;
+
+	// unlinks it
+	cache->entries[entry->prev_lru].next_lru = entry->next_lru;
+	if(entry->next_lru != -1) cache->entries[entry->next_lru].prev_lru = entry->prev_lru;
+	else cache->lru_last = entry->prev_lru;
+
+	// and puts it first
+	entry->prev_lru = -1;
+	entry->next_lru = cache->lru_first;
+	cache->entries[cache->lru_first].prev_lru = i;
+	cache->lru_first = i;
+}
+
+
+// removes the entry i from its bucket, leaving it unused
+static void SimpleFS_dcacheUnhash(DentryCache* cache, int i){
+
+	Dentry* entry = &cache->entries[i];
+	if(entry->dir_block == -1) return;
+
+	int* link = &cache->buckets[SimpleFS_dcacheBucket(entry->dir_block, entry->hash, entry->is_dir)];
+	while(*link != i) link = &cache->entries[*link].next_hash;
+	*link = entry->next_hash;
+
+	entry->next_hash = -1;
+	entry->dir_block = -1;
+}
+
+
+// looks for name in the dentry cache of the directory dir_block
+// returns 1 and the first block of the entry in block (-1 if the directory has no such entry) if cached, 0 otherwise
+static int SimpleFS_dcacheLookup(SimpleFS* fs, int dir_block, const char* name, int is_dir, int* block){
+
+	DentryCache* cache = &fs->dcache;
+	int i = SimpleFS_dcacheFind(cache, dir_block, name, SimpleFS_hash(name), is_dir);
+	if(i == -1) {
+		cache->misses++;
+		return 0;
+	}
+
+	cache->hits++;
+	SimpleFS_dcacheTouch(cache, i);
+	*block = cache->entries[i].block;
+	return 1;
+}
+
+
+// records that name in the directory dir_block is the entry block (-1 if there is no such entry)
+// the least recently used entry makes room for it
+static void SimpleFS_dcacheSet(SimpleFS* fs, int dir_block, const char* name, int is_dir, int block){
+
+	// names too long for an entry are never cached
+	if(strlen(name) >= sizeof(((Dentry*) 0)->name)) return;
+
+	DentryCache* cache = &fs->dcache;
+	unsigned int hash = SimpleFS_hash(name);
+	int i = SimpleFS_dcacheFind(cache, dir_block, name, hash, is_dir);
+
+	if(i == -1) {
+		i = cache->lru_last;
+		SimpleFS_dcacheUnhash(cache, i);
+
+		Dentry* entry = &cache->entries[i];
+		entry->dir_block = dir_block;
+		entry->is_dir = is_dir;
+		entry->hash = hash;
+		strcpy(entry->name, name);
+
+		int bucket = SimpleFS_dcacheBucket(dir_block, hash, is_dir);
+		entry->next_hash = cache->buckets[bucket];
+		cache->buckets[bucket] = i;
+	}
+
+	cache->entries[i].block = block;
+	SimpleFS_dcacheTouch(cache, i);
+}
+
+
+// forgets every name cached in the directory dir_block, when the directory is removed
+static void SimpleFS_dcacheDrop(SimpleFS* fs, int dir_block){
+
+	int i;
+	for(i = 0; i < SIMPLEFS_DCACHE_SIZE; i++) {
+		if(fs->dcache.entries[i].dir_block == dir_block) SimpleFS_dcacheUnhash(&fs->dcache, i);
+	}
+}
+
+
 // initializes a file system on an already made disk
 // returns a handle to the top level directory stored in the first block
 DirectoryHandle* SimpleFS_init(SimpleFS* fs, DiskDriver* disk){
@@ -16,8 +159,26 @@ DirectoryHandle* SimpleFS_init(SimpleFS* fs, DiskDriver* disk){
 
 	// sets "disk" as the first file system's disk
 	fs->disk = disk;
+	SimpleFS_dcacheInit(&fs->dcache);
+	BlockCache_init(&fs->cache, disk, BLOCK_CACHE_DEFAULT_FRAMES);
+	
+	// the arrays of the blocks fill what the headers leave of a block
+	fs->block_size = disk->block_size;
+	fs->ffb_data_size = fs->block_size - sizeof(FirstFileBlock);
+	fs->fb_data_size = fs->block_size - sizeof(FileBlock);
+	fs->fdb_entries = (fs->block_size - sizeof(FirstDirectoryBlock)) / sizeof(int);
+	fs->db_entries = (fs->block_size - sizeof(DirectoryBlock)) / sizeof(int);
+	fs->index_entries = (fs->block_size - sizeof(IndexBlock)) / sizeof(int);
+	fs->bucket_entries = (fs->block_size - sizeof(HashBlock)) / sizeof(DirEntry);
+
+	// the handles and the copies of the blocks are taken from slabs, the temporary arrays from the arena
+	Slab_init(&fs->buffers, fs->block_size, SIMPLEFS_SLAB_BUFFERS);
+	Slab_init(&fs->file_handles, sizeof(FileHandle), SIMPLEFS_SLAB_HANDLES);
+	Slab_init(&fs->dir_handles, sizeof(DirectoryHandle), SIMPLEFS_SLAB_HANDLES);
+	if(Arena_init(&fs->scratch, SIMPLEFS_SCRATCH_SIZE) == -1) return NULL;
 	
-	DirectoryHandle* directory_handle = (DirectoryHandle*) malloc(sizeof(DirectoryHandle));	
+	DirectoryHandle* directory_handle = (DirectoryHandle*) Slab_alloc(&fs->dir_handles);
+	if(!directory_handle) return NULL;
 	
 	// the root directory should be in the first block	
 	if(fs->disk->header->first_free_block == 0){
@@ -33,14 +194,12 @@ DirectoryHandle* SimpleFS_init(SimpleFS* fs, DiskDriver* disk){
 	directory_handle->sfs = fs;
 	
 	// retrieves fdb info from disk
-	FirstDirectoryBlock* root = (FirstDirectoryBlock*) malloc(sizeof(FirstDirectoryBlock));
-	DiskDriver_readBlock(disk, root, 0);
+	FirstDirectoryBlock* root = (FirstDirectoryBlock*) Slab_alloc(&fs->buffers);
+	BlockCache_readBlock(&fs->cache, root, 0);
 	
 	directory_handle->dcb = root;
 	directory_handle->directory = NULL;
-	directory_handle->current_block = &(directory_handle->dcb->header);
-	directory_handle->pos_in_dir = 0;
-	directory_handle->pos_in_block = root->fcb.block_in_disk;
+	SimpleFS_rewindDir(directory_handle);
 	
 	return directory_handle;
 }
@@ -48,7 +207,7 @@ DirectoryHandle* SimpleFS_init(SimpleFS* fs, DiskDriver* disk){
 
 // creates the initial structures, the top level directory
 // has name "/" and its control block is in the first position
-// it also clears the bitmap of occupied blocks on the disk
+// it also clears the bitmap of occupied blocks on the disk and the queue of the removed files
 // the current_directory_block is cached in the SimpleFS struct
 // and set to the top level directory
 void SimpleFS_format(SimpleFS* fs) {
@@ -56,13 +215,26 @@ void SimpleFS_format(SimpleFS* fs) {
 	// security check on fs correct initialization
 	if(!fs) return;
 
-	// bitmap reset
-	for(int i = 0; i < fs->disk->map->num_bits; i++) {
-		BitMap_set(fs->disk->map, i, 0);
-	}
+	// the names and blocks cached belong to the file system being replaced
+	SimpleFS_dcacheInit(&fs->dcache);
+	BlockCache_invalidate(&fs->cache);
+
+	// the removed files waiting to be reclaimed go with the rest
+	while(fs->disk->header->reclaim_count > 0) DiskDriver_dequeueReclaim(fs->disk);
+
+	// bitmap reset through the driver, that keeps the counters of the header and writes it
+	ArenaMark mark = Arena_mark(&fs->scratch);
+	int* blocks = (int*) Arena_alloc(&fs->scratch, fs->disk->header->num_blocks * sizeof(int));
+	if(!blocks) return;
+	for(int i = 0; i < fs->disk->header->num_blocks; i++) blocks[i] = i;
+	int ret = DiskDriver_freeBlocks(fs->disk, blocks, fs->disk->header->num_blocks);
+	Arena_release(&fs->scratch, mark);
+	if(ret == -1) return;
 	
-	// first block of the root directory allocation
-	FirstDirectoryBlock * root = malloc(sizeof(FirstDirectoryBlock));
+	// the root directory is built in place in its block
+	int root_block = fs->disk->header->first_free_block;
+	FirstDirectoryBlock * root = (FirstDirectoryBlock*) BlockCache_pinBlock(&fs->cache, root_block);
+	if(!root) return;
 
 	// initializes fdb's header
 	root->header.previous_block = -1;
@@ -71,24 +243,407 @@ void SimpleFS_format(SimpleFS* fs) {
 
 	// initializes fdb's file control block
 	root->fcb.directory_block = -1;
-	root->fcb.block_in_disk = fs->disk->header->first_free_block;
+	root->fcb.block_in_disk = root_block;
 	strcpy(root->fcb.name,"/");
-	root->fcb.size_in_bytes = sizeof(FirstDirectoryBlock);
+	root->fcb.size_in_bytes = fs->block_size;
 	root->fcb.size_in_blocks = root->fcb.size_in_bytes;
 	root->fcb.is_dir = 1;
+	root->fcb.index_block = -1;
+	root->fcb.indirect_block = -1;
+	memset(root->fcb.extents, 0, sizeof(root->fcb.extents));
+	root->fcb.prealloc_block = -1;
+	root->fcb.prealloc_blocks = 0;
+	root->fcb.last_block = -1;
+	root->fcb.last_fill = 0;
+	root->fcb.removed_stamp = 0;
 	root->num_entries = 0;
 
 	// resets file_blocks
-	memset(root->file_blocks, 0, sizeof(root->file_blocks));
+	memset(root->file_blocks, 0, fs->fdb_entries*sizeof(int));
 
 	// writes first_directory_block in disk
-	DiskDriver_writeBlock(fs->disk, root, fs->disk->header->first_free_block);
-	DiskDriver_flush(fs->disk);	
-	free(root);
+	BlockCache_commitBlock(&fs->cache, root, root_block);
+	BlockCache_sync(&fs->cache);	
 	return;
 }
 
 
+// sets the number of blocks kept in the block cache of fs (0 disables it)
+// the changed blocks are written back first
+// returns -1 if the cache can't be allocated, it is then disabled
+int SimpleFS_setCacheSize(SimpleFS* fs, int num_frames){
+
+	// security check on input args
+	if(!fs || num_frames < 0) return -1;
+
+	BlockCache_destroy(&fs->cache);
+	if(BlockCache_init(&fs->cache, fs->disk, num_frames) == -1) {
+		BlockCache_init(&fs->cache, fs->disk, 0);
+		return -1;
+	}
+	return 0;
+}
+
+
+// writes back the blocks changed in the cache and frees the resources of fs
+// the disk is left open
+void SimpleFS_destroy(SimpleFS* fs){
+
+	// security check on input args
+	if(!fs) return;
+
+	BlockCache_destroy(&fs->cache);
+	DiskDriver_sync(fs->disk);
+
+	Slab_destroy(&fs->buffers);
+	Slab_destroy(&fs->file_handles);
+	Slab_destroy(&fs->dir_handles);
+	Arena_destroy(&fs->scratch);
+}
+
+
+// reclaims the removed files until n blocks are free, or the queue is empty
+// returns 1 if n blocks are free
+static int SimpleFS_ensureFree(SimpleFS* fs, int n){
+
+	while(fs->disk->header->free_blocks < n && fs->disk->header->reclaim_count > 0) {
+		if(SimpleFS_reclaim(fs, 1) == -1) break;
+	}
+
+	return fs->disk->header->free_blocks >= n;
+}
+
+
+// creates an empty IndexBlock in the first free block
+// returns its block, -1 if the disk is full
+static int SimpleFS_newIndex(SimpleFS* fs){
+
+	if(!SimpleFS_ensureFree(fs, 1)) return -1;
+	int block_num = fs->disk->header->first_free_block;
+
+	IndexBlock* index = (IndexBlock*) BlockCache_pinBlock(&fs->cache, block_num);
+	if(!index) return -1;
+
+	index->header.previous_block = -1;
+	index->header.next_block = -1;
+	index->header.block_in_file = -1;
+	memset(index->blocks, 0xff, fs->index_entries*sizeof(int));
+
+	if(BlockCache_commitBlock(&fs->cache, index, block_num) == -1) return -1;
+	return block_num;
+}
+
+
+// returns the first bucket block of the chain of hash in the table of the directory dcb, -1 if empty
+static int SimpleFS_bucket(SimpleFS* fs, const FirstDirectoryBlock* dcb, unsigned int hash){
+
+	const IndexBlock* table = (const IndexBlock*) BlockCache_getBlock(&fs->cache, dcb->fcb.index_block);
+	if(!table) return -1;
+	int bucket = table->blocks[hash % fs->index_entries];
+	BlockCache_putBlock(&fs->cache, table);
+
+	return bucket;
+}
+
+
+// adds the entry block called name to the hash table of the directory dcb
+// the table is created with the first entry of the directory (dcb is written by the caller)
+// returns -1 if the table can't grow, the directory is then looked up by scanning it
+static int SimpleFS_hashInsert(SimpleFS* fs, FirstDirectoryBlock* dcb, const char* name, int block){
+
+	DiskDriver* disk = fs->disk;
+	BlockCache* cache = &fs->cache;
+
+	// a table created later wouldn't have the entries already there
+	if(dcb->fcb.index_block == -1) {
+		if(dcb->num_entries != 0) return -1;
+		dcb->fcb.index_block = SimpleFS_newIndex(fs);
+		if(dcb->fcb.index_block == -1) return -1;
+	}
+
+	unsigned int hash = SimpleFS_hash(name);
+
+	// looks for a bucket block with room in the chain of hash
+	int bucket = SimpleFS_bucket(fs, dcb, hash), last = -1;
+	while(bucket != -1) {
+		const HashBlock* hb = (const HashBlock*) BlockCache_getBlock(cache, bucket);
+		if(!hb) return -1;
+		int full = hb->num_entries >= fs->bucket_entries;
+		int next_block = hb->header.next_block;
+		BlockCache_putBlock(cache, hb);
+
+		if(!full) break;
+		last = bucket;
+		bucket = next_block;
+	}
+
+	// the chain is full, a new bucket block is appended
+	int created = bucket == -1;
+	if(created) {
+		if(!SimpleFS_ensureFree(fs, 1)) return -1;
+		bucket = disk->header->first_free_block;
+	}
+
+	HashBlock* hb = (HashBlock*) BlockCache_pinBlock(cache, bucket);
+	if(!hb) return -1;
+	if(created) {
+		hb->header.previous_block = last;
+		hb->header.next_block = -1;
+		hb->header.block_in_file = -1;
+		hb->num_entries = 0;
+	}
+	hb->entries[hb->num_entries].hash = hash;
+	hb->entries[hb->num_entries].block = block;
+	hb->num_entries++;
+	if(BlockCache_commitBlock(cache, hb, bucket) == -1) return -1;
+	if(!created) return 0;
+
+	// links the new bucket block, to the table or to the last block of the chain
+	int link_block = last == -1 ? dcb->fcb.index_block : last;
+	void* link = BlockCache_pinBlock(cache, link_block);
+	if(!link) return -1;
+	if(last == -1) ((IndexBlock*) link)->blocks[hash % fs->index_entries] = bucket;
+	else ((HashBlock*) link)->header.next_block = bucket;
+
+	return BlockCache_commitBlock(cache, link, link_block);
+}
+
+
+// removes the entry block called name from the hash table of the directory dcb
+// the last entry of its bucket block takes its place, a bucket block left empty is unlinked and freed
+static void SimpleFS_hashRemove(SimpleFS* fs, const FirstDirectoryBlock* dcb, const char* name, int block){
+
+	if(dcb->fcb.index_block == -1) return;
+
+	BlockCache* cache = &fs->cache;
+	unsigned int hash = SimpleFS_hash(name);
+	int bucket = SimpleFS_bucket(fs, dcb, hash);
+	while(bucket != -1) {
+		const HashBlock* hb = (const HashBlock*) BlockCache_getBlock(cache, bucket);
+		if(!hb) return;
+
+		int i;
+		for(i = 0; i < hb->num_entries && hb->entries[i].block != block; i++) {}
+		int found = i < hb->num_entries, empty = hb->num_entries == 1;
+		int next_block = hb->header.next_block, prev_block = hb->header.previous_block;
+		BlockCache_putBlock(cache, hb);
+
+		if(found && !empty) {
+			HashBlock* pinned = (HashBlock*) BlockCache_pinBlock(cache, bucket);
+			if(!pinned) return;
+			pinned->num_entries--;
+			pinned->entries[i] = pinned->entries[pinned->num_entries];
+			BlockCache_commitBlock(cache, pinned, bucket);
+			return;
+		}
+
+		if(found) {
+
+			// the block before it, or the table, points to the following one
+			int link_block = prev_block == -1 ? dcb->fcb.index_block : prev_block;
+			void* link = BlockCache_pinBlock(cache, link_block);
+			if(!link) return;
+			if(prev_block == -1) ((IndexBlock*) link)->blocks[hash % fs->index_entries] = next_block;
+			else ((HashBlock*) link)->header.next_block = next_block;
+			BlockCache_commitBlock(cache, link, link_block);
+
+			if(next_block != -1) {
+				HashBlock* next = (HashBlock*) BlockCache_pinBlock(cache, next_block);
+				if(!next) return;
+				next->header.previous_block = prev_block;
+				BlockCache_commitBlock(cache, next, next_block);
+			}
+
+			BlockCache_freeBlock(cache, bucket);
+			return;
+		}
+		bucket = next_block;
+	}
+}
+
+
+// looks in the hash table of the directory dcb for the entry called name, a file (is_dir = 0) or a directory (is_dir = 1)
+// only the chain of the hash of name is read, and the first blocks of the entries with the same hash
+// returns the first block of the entry, -1 if not found
+static int SimpleFS_hashLookup(SimpleFS* fs, const FirstDirectoryBlock* dcb, const char* name, int is_dir){
+
+	BlockCache* cache = &fs->cache;
+	unsigned int hash = SimpleFS_hash(name);
+
+	int bucket = SimpleFS_bucket(fs, dcb, hash), found = -1;
+	while(bucket != -1 && found == -1) {
+		const HashBlock* hb = (const HashBlock*) BlockCache_getBlock(cache, bucket);
+		if(!hb) break;
+
+		int i;
+		for(i = 0; i < hb->num_entries && found == -1; i++) {
+			if(hb->entries[i].hash != hash) continue;
+
+			// the same hash, compares the name and the type of the entry
+			const FirstFileBlock* ffb = (const FirstFileBlock*) BlockCache_getBlock(cache, hb->entries[i].block);
+			if(!ffb) continue;
+			if(strcmp(ffb->fcb.name, name) == 0 && ffb->fcb.is_dir == is_dir) found = hb->entries[i].block;
+			BlockCache_putBlock(cache, ffb);
+		}
+
+		bucket = hb->header.next_block;
+		BlockCache_putBlock(cache, hb);
+	}
+
+	return found;
+}
+
+
+// adds the entry block called name, a file (is_dir = 0) or a directory (is_dir = 1), to the directory d
+// in its hash table, in the dentry cache and in the first free slot of its entries
+// the search starts from the block pointed by the hint of the directory (fcb.last_block), the blocks
+// before it are full, and a new directory block is chained when the last one is full
+// the directory control block is written once at the end
+// returns -1 if the entry can't go in the hash table of the directory, which is then left without it,
+// or if there's no free block for a new directory block
+static int SimpleFS_addEntry(DirectoryHandle* d, int block, const char* name, int is_dir){
+
+	SimpleFS* fs = d->sfs;
+	FirstDirectoryBlock* dcb = d->dcb;
+
+	// a directory with a hash table is looked up only through it
+	if(SimpleFS_hashInsert(fs, dcb, name, block) == -1 && dcb->fcb.index_block != -1) {
+		BlockCache_writeBlock(&fs->cache, dcb, dcb->fcb.block_in_disk);
+		return -1;
+	}
+	SimpleFS_dcacheSet(fs, dcb->fcb.block_in_disk, name, is_dir, block);
+
+	// the entries of a block are packed at its beginning, it has room if the last slot is free
+	if(dcb->fcb.last_block == -1 && dcb->file_blocks[fs->fdb_entries-1] == 0) {
+		int i;
+		for(i = 0; dcb->file_blocks[i] != 0; i++) {}
+		dcb->file_blocks[i] = block;
+		dcb->num_entries++;
+		BlockCache_writeBlock(&fs->cache, dcb, dcb->fcb.block_in_disk);
+		return 0;
+	}
+
+	DirectoryBlock* db = (DirectoryBlock*) Slab_alloc(&fs->buffers);
+	if(!db) return -1;
+
+	// looks for a directory block with room from the hint
+	int curr_block = dcb->fcb.last_block == -1 ? dcb->header.next_block : dcb->fcb.last_block;
+	int prev_block = dcb->fcb.block_in_disk, position = 0;
+	while(curr_block != -1) {
+		if(BlockCache_readBlock(&fs->cache, db, curr_block) == -1) {
+			Slab_free(&fs->buffers, db);
+			return -1;
+		}
+		if(db->file_blocks[fs->db_entries-1] == 0) break;
+		prev_block = curr_block;
+		position = db->header.block_in_file;
+		curr_block = db->header.next_block;
+	}
+
+	// every block is full, a new one is chained after the last
+	if(curr_block == -1) {
+		if(!SimpleFS_ensureFree(fs, 1)) {
+			Slab_free(&fs->buffers, db);
+			BlockCache_writeBlock(&fs->cache, dcb, dcb->fcb.block_in_disk);
+			return -1;
+		}
+		curr_block = fs->disk->header->first_free_block;
+		memset(db, 0, fs->block_size);
+		db->header.previous_block = prev_block;
+		db->header.next_block = -1;
+		db->header.block_in_file = position+1;
+		BlockCache_writeBlock(&fs->cache, db, curr_block);
+
+		if(prev_block == dcb->fcb.block_in_disk) dcb->header.next_block = curr_block;
+		else {
+			DirectoryBlock* prev = (DirectoryBlock*) BlockCache_pinBlock(&fs->cache, prev_block);
+			if(prev) {
+				prev->header.next_block = curr_block;
+				BlockCache_commitBlock(&fs->cache, prev, prev_block);
+			}
+		}
+	}
+
+	int i;
+	for(i = 0; db->file_blocks[i] != 0; i++) {}
+	db->file_blocks[i] = block;
+	BlockCache_writeBlock(&fs->cache, db, curr_block);
+
+	// the next search starts from this block
+	dcb->fcb.last_block = curr_block;
+	dcb->fcb.last_fill = db->header.block_in_file;
+	dcb->num_entries++;
+	Slab_free(&fs->buffers, db);
+
+	// update the new info in disk
+	BlockCache_writeBlock(&fs->cache, dcb, dcb->fcb.block_in_disk);
+	return 0;
+}
+
+
+// looks in the directory dcb for the entry called name, a file (is_dir = 0) or a directory (is_dir = 1)
+// scanning every entry of the directory
+// returns the first block of the entry, -1 if not found
+static int SimpleFS_scanEntries(SimpleFS* fs, const FirstDirectoryBlock* dcb, const char* name, int is_dir){
+
+	BlockCache* cache = &fs->cache;
+
+	// entries of the first directory block
+	const int* file_blocks = dcb->file_blocks;
+	int block_entries = fs->fdb_entries;
+	int next_block = dcb->header.next_block;
+	const DirectoryBlock* db = NULL;
+
+	// every slot is scanned, the removals leave holes
+	int dim_array = 0, found = -1;
+	for(; found == -1; dim_array++){
+		
+		// if the array is finished moves to the next directory block
+		if(dim_array >= block_entries){
+			
+			if(next_block == -1) break;
+			if(db) BlockCache_putBlock(cache, db);
+			db = (const DirectoryBlock*) BlockCache_getBlock(cache, next_block);
+			if(!db) return -1;
+			
+			file_blocks = db->file_blocks;
+			block_entries = fs->db_entries;
+			next_block = db->header.next_block;
+			dim_array = 0;
+		}
+		
+		// compares the name and the type of the entry
+		if(!file_blocks[dim_array]) continue;
+		const FirstFileBlock* ffb = (const FirstFileBlock*) BlockCache_getBlock(cache, file_blocks[dim_array]);
+		if(!ffb) continue;
+		
+		if(strcmp(ffb->fcb.name, name) == 0 && ffb->fcb.is_dir == is_dir) found = file_blocks[dim_array];
+		BlockCache_putBlock(cache, ffb);
+	}
+	
+	if(db) BlockCache_putBlock(cache, db);
+	return found;
+}
+
+
+// looks in the directory dcb for the entry called name, a file (is_dir = 0) or a directory (is_dir = 1)
+// in the dentry cache, then through the hash table of the directory, or scanning its entries if it has none
+// the blocks are read in place, without copying them
+// returns the first block of the entry, -1 if not found
+static int SimpleFS_findEntry(SimpleFS* fs, const FirstDirectoryBlock* dcb, const char* name, int is_dir){
+
+	int found = -1, dir_block = dcb->fcb.block_in_disk;
+	if(SimpleFS_dcacheLookup(fs, dir_block, name, is_dir, &found)) return found;
+
+	// the result is cached, found or not
+	if(dcb->fcb.index_block != -1) found = SimpleFS_hashLookup(fs, dcb, name, is_dir);
+	else found = SimpleFS_scanEntries(fs, dcb, name, is_dir);
+
+	SimpleFS_dcacheSet(fs, dir_block, name, is_dir, found);
+	return found;
+}
+
+
 // creates an empty file in the directory d
 // returns null on error (file existing, no free blocks)
 // an empty file consists only of a block of type FirstBlock
@@ -97,178 +652,200 @@ FileHandle* SimpleFS_createFile(DirectoryHandle* d, const char* filename) {
 	// security check on input args
 	if(!d || !filename) return NULL;
 	
-	// security check on free blocks
-	if(d->sfs->disk->header->free_blocks <= 2){
+	// security check on free blocks: the first block of the file, a new directory block,
+	// and the table and a bucket block of the hash table of the directory
+	if(!SimpleFS_ensureFree(d->sfs, 4)){
 		printf("\nThe disk is full\n");
 		return NULL; 
 	}
 	
 	// checks if already exists a file named filename
-	if(SimpleFS_openFile(d, filename) != NULL) return NULL;
+	if(SimpleFS_findEntry(d->sfs, d->dcb, filename, 0) != -1) return NULL;
 
 	// file handle allocation
-	FileHandle * file_handle = malloc(sizeof(FileHandle));
+	FileHandle * file_handle = (FileHandle*) Slab_alloc(&d->sfs->file_handles);
+	FirstFileBlock * ffb = (FirstFileBlock*) Slab_alloc(&d->sfs->buffers);
+	if(!file_handle || !ffb) {
+		Slab_free(&d->sfs->file_handles, file_handle);
+		Slab_free(&d->sfs->buffers, ffb);
+		return NULL;
+	}
 	file_handle->sfs = d->sfs;
 	
-	// first file block allocation and initialization
-	FirstFileBlock * ffb = malloc(sizeof(FirstFileBlock)); 
+	// first file block initialization
 	ffb->header.previous_block = -1;
 	ffb->header.next_block = -1;
 	ffb->header.block_in_file = 0;
 	ffb->fcb.directory_block = d->dcb->fcb.block_in_disk;
-	ffb->fcb.block_in_disk = DiskDriver_getFreeBlock(d->sfs->disk, 0);
+	ffb->fcb.block_in_disk = d->sfs->disk->header->first_free_block;
 	strcpy(ffb->fcb.name, filename);
 	ffb->fcb.size_in_bytes = 0;
 	ffb->fcb.size_in_blocks = ffb->fcb.size_in_bytes;
 	ffb->fcb.is_dir = 0;
+	ffb->fcb.index_block = -1;
+	ffb->fcb.indirect_block = -1;
+	memset(ffb->fcb.extents, 0, sizeof(ffb->fcb.extents));
+	ffb->fcb.prealloc_block = -1;
+	ffb->fcb.prealloc_blocks = 0;
+	ffb->fcb.last_block = ffb->fcb.block_in_disk;
+	ffb->fcb.last_fill = 0;
+	ffb->fcb.removed_stamp = 0;
 	
 	file_handle->directory = d->dcb;
 	file_handle->current_block = &(ffb->header);
 	file_handle->pos_in_file = 0;
+	file_handle->cursor_block = ffb->fcb.block_in_disk;
+	file_handle->cursor_index = 0;
+	file_handle->pos_in_block = 0;
+	file_handle->flags = 0;
 	file_handle->fcb = ffb;
 
 	// resets file data with "end of line"
-	memset(ffb->data, '\0', sizeof(ffb->data));
+	memset(ffb->data, '\0', d->sfs->ffb_data_size);
 
 	// writes ffb in disk
-	DiskDriver_writeBlock(d->sfs->disk, ffb, ffb->fcb.block_in_disk);
+	BlockCache_writeBlock(&d->sfs->cache, ffb, ffb->fcb.block_in_disk);
+
+	// adds the file to the directory, or gives its block back
+	if(SimpleFS_addEntry(d, ffb->fcb.block_in_disk, filename, 0) == -1) {
+		BlockCache_freeBlock(&d->sfs->cache, ffb->fcb.block_in_disk);
+		BlockCache_sync(&d->sfs->cache);
+		Slab_free(&d->sfs->file_handles, file_handle);
+		Slab_free(&d->sfs->buffers, ffb);
+		return NULL;
+	}
+	
+	BlockCache_sync(&d->sfs->cache);
+	return file_handle;
+}
 
-	// checks if the directory is full
-	if(d->dcb->file_blocks[sizeof(d->dcb->file_blocks)-1] == 0){
-		
-		//~ printf("\n\nThere's free space in first directory block\n\n");
 
-		// finds the first free index in file_blocks
-		int i;
-		for(i = 0; d->dcb->file_blocks[i] != 0; i++) {}
+// reads the entries of the directory d from its cursor into records, at most max
+// the slots left free by removed entries are skipped
+// returns the number of records filled, -1 if a block of the directory can't be read
+static int SimpleFS_walkDir(DirectoryHandle* d, DirRecord* records, int max){
 
-		// updates directory control block info
-		d->dcb->file_blocks[i] = ffb->fcb.block_in_disk;	
-		d->dcb->num_entries++;
+	SimpleFS* fs = d->sfs;
+	BlockCache* cache = &fs->cache;
 
-		// update the new info in disk
-		DiskDriver_writeBlock(d->sfs->disk, d->dcb, d->dcb->fcb.block_in_disk);
-		
-	}else{
-		
-		DirectoryBlock* db = (DirectoryBlock*) malloc(sizeof(DirectoryBlock));
-		
-		// first directory block has a next directory block
-		if(d->dcb->header.next_block != -1){
-			
-			// looks for a free directory block or a to-be-created directory block
-			DiskDriver_readBlock(d->sfs->disk, db, d->dcb->header.next_block);
-			int curr_block = d->dcb->header.next_block;
-			while(db->file_blocks[sizeof(db->file_blocks)-1] != 0 && db->header.next_block != -1){
-				
-				curr_block = db->header.next_block;
-				DiskDriver_readBlock(d->sfs->disk, db, db->header.next_block);
-			}
-			
-			// directory block is free
-			if(db->file_blocks[sizeof(db->file_blocks)-1] == 0){
-				//~ printf("\n\nThere's free space in directory block %d\n\n", curr_block);
+	int n = 0;
+	while(n < max && d->cursor_block != -1) {
 
-				// finds the first free index in file_blocks
-				int i;
-				for(i = 0; db->file_blocks[i] != 0; i++) {}
+		// the first directory block is the copy kept by the handle, the others are read in place
+		const DirectoryBlock* db = NULL;
+		const int* file_blocks = d->dcb->file_blocks;
+		int block_entries = fs->fdb_entries;
+		int next_block = d->dcb->header.next_block;
 
-				// updates directory control block info
-				db->file_blocks[i] = ffb->fcb.block_in_disk;	
-				d->dcb->num_entries++;
+		if(d->cursor_block != d->dcb->fcb.block_in_disk) {
+			db = (const DirectoryBlock*) BlockCache_getBlock(cache, d->cursor_block);
+			if(!db) return -1;
 
-				// update the new info in disk
-				DiskDriver_writeBlock(d->sfs->disk, db, curr_block);
-			}
-			
-			// next directory block doesn't exist
-			else if(db->header.next_block == -1){
-				//~ printf("\n\nCreating a new directory block because %d is full and has no next block, next block position = %d\n\n", curr_block, d->sfs->disk->header->first_free_block);
-
-				// creates new directory block
-				int free_block = d->sfs->disk->header->first_free_block;
-				DirectoryBlock* new_db = (DirectoryBlock*) malloc(sizeof(DirectoryBlock));
-				new_db->header.block_in_file = db->header.block_in_file+1;
-				new_db->header.next_block = -1;
-				new_db->header.previous_block = curr_block;
-				
-				db->header.next_block = free_block;
-				DiskDriver_writeBlock(d->sfs->disk, db, curr_block);
-				
-				// updates directory control block info
-				db->file_blocks[0] = ffb->fcb.block_in_disk;	
-				d->dcb->num_entries++;
+			file_blocks = db->file_blocks;
+			block_entries = fs->db_entries;
+			next_block = db->header.next_block;
+		}
 
-				// update the new info in disk
-				DiskDriver_writeBlock(d->sfs->disk, new_db, free_block);
-				free(new_db);				
-			}
+		for(; n < max && d->pos_in_block < block_entries; d->pos_in_block++) {
+			if(!file_blocks[d->pos_in_block]) continue;
+
+			// copies the record from the first block of the entry
+			const FirstFileBlock* ffb = (const FirstFileBlock*) BlockCache_getBlock(cache, file_blocks[d->pos_in_block]);
+			if(!ffb) continue;
+
+			DirRecord* record = &records[n++];
+			memcpy(record->name, ffb->fcb.name, sizeof(record->name));
+			record->block = file_blocks[d->pos_in_block];
+			record->size_in_bytes = ffb->fcb.size_in_bytes;
+			record->is_dir = ffb->fcb.is_dir;
+			BlockCache_putBlock(cache, ffb);
+
+			d->pos_in_dir++;
 		}
-		else{
-			
-			//~ printf("\n\nCreating a new directory block because the first one is full and has no next block, next block position = %d\n\n", d->sfs->disk->header->first_free_block);
-			
-			// creates new directory block
-			int free_block = d->sfs->disk->header->first_free_block;
-			DirectoryBlock* new_db = (DirectoryBlock*) malloc(sizeof(DirectoryBlock));
-			new_db->header.block_in_file = db->header.block_in_file+1;
-			new_db->header.next_block = -1;
-			new_db->header.previous_block = d->dcb->fcb.block_in_disk;
-				
-			d->dcb->header.next_block = free_block;
-			DiskDriver_writeBlock(d->sfs->disk, d->dcb, d->dcb->fcb.block_in_disk);
-			
-			// updates directory control block info
-			db->file_blocks[0] = ffb->fcb.block_in_disk;	
-			d->dcb->num_entries++;
+		if(db) BlockCache_putBlock(cache, db);
 
-			// update the new info in disk
-			DiskDriver_writeBlock(d->sfs->disk, new_db, free_block);
-			free(new_db);
+		// the block is finished, the cursor moves to the next one
+		if(d->pos_in_block >= block_entries) {
+			d->cursor_block = next_block;
+			d->pos_in_block = 0;
 		}
-		free(db);	
 	}
-	
-	DiskDriver_flush(d->sfs->disk);
-	return file_handle;
+
+	return n;
+}
+
+
+// fills records with the next entries of the directory d, at most max, from the cursor of d
+int SimpleFS_readDirRecords(DirectoryHandle* d, DirRecord* records, int max){
+
+	// security check on input args
+	if(!d || !records || max < 0) return -1;
+
+	return SimpleFS_walkDir(d, records, max);
+}
+
+
+// moves the cursor of d back to the first entry of the directory
+void SimpleFS_rewindDir(DirectoryHandle* d){
+
+	// security check on input args
+	if(!d) return;
+
+	d->current_block = &(d->dcb->header);
+	d->pos_in_dir = 0;
+	d->pos_in_block = 0;
+	d->cursor_block = d->dcb->fcb.block_in_disk;
 }
 
 
 // reads in the (preallocated) blocks array, the name of all files in a directory
+// the entries are read a page at a time, the cursor of d is left where it was
 int SimpleFS_readDir(char** names, DirectoryHandle* d) {
 
 	// security check on input args
 	if(!names || !d) return -1;
 
-	FirstFileBlock * ffb = (FirstFileBlock*) malloc(sizeof(FirstFileBlock));
+	int pos_in_dir = d->pos_in_dir, pos_in_block = d->pos_in_block, cursor_block = d->cursor_block;
+	SimpleFS_rewindDir(d);
 
-	// first directory block pointer
-	FirstDirectoryBlock * db = (FirstDirectoryBlock*) malloc(sizeof(FirstDirectoryBlock));
-	db = d->dcb;
+	DirRecord records[SIMPLEFS_READDIR_PAGE];
+	int i = 0, j, n = 0;
+	while(i < d->dcb->num_entries && (n = SimpleFS_walkDir(d, records, SIMPLEFS_READDIR_PAGE)) > 0) {
+		for(j = 0; j < n && i < d->dcb->num_entries; j++) strcpy(names[i++], records[j].name);
+	}
 
-	int i, dim_array = 0;
-	for(i = 0; i < d->dcb->num_entries; i++, dim_array++) {
+	d->pos_in_dir = pos_in_dir;
+	d->pos_in_block = pos_in_block;
+	d->cursor_block = cursor_block;
+	return n == -1 ? -1 : 0;
+}
 
-		// if the array is finished
-		if(dim_array >= sizeof(db->file_blocks)) {
-			DirectoryBlock * db;
 
-			// updates relative index
-			dim_array = dim_array - sizeof(db->file_blocks);
+// returns a handle on the file whose first block is block, stored in the directory directory
+// NULL if the block can't be read
+static FileHandle* SimpleFS_openBlock(SimpleFS* fs, int block, FirstDirectoryBlock* directory){
 
-			// reads the next directory block
-			DiskDriver_readBlock(d->sfs->disk, db, db->header.next_block);
-		}
+	// the handle keeps its own copy of the first file block
+	FirstFileBlock * ffb = (FirstFileBlock*) Slab_alloc(&fs->buffers);
+	FileHandle * file_handle = (FileHandle*) Slab_alloc(&fs->file_handles);
+	if(!ffb || !file_handle || BlockCache_readBlock(&fs->cache, ffb, block) == -1){
+		Slab_free(&fs->buffers, ffb);
+		Slab_free(&fs->file_handles, file_handle);
+		return NULL;
+	}
 
-		// retrieves the first file block in db->file_blocks[dim_array]
-		ffb = (FirstFileBlock*) malloc(sizeof(FirstFileBlock));
-		DiskDriver_readBlock(d->sfs->disk, ffb, db->file_blocks[dim_array]);
+	// initializes file_handle
+	file_handle->sfs = fs;
+	file_handle->fcb = ffb;
+	file_handle->directory = directory;
+	file_handle->current_block = &(ffb->header);
+	file_handle->pos_in_file = 0;
+	file_handle->cursor_block = ffb->fcb.block_in_disk;
+	file_handle->cursor_index = 0;
+	file_handle->pos_in_block = 0;
+	file_handle->flags = 0;
 
-		names[dim_array] = ffb->fcb.name;
-		
-	}
-	free(ffb);
-	return 0;
+	return file_handle;
 }
 
 
@@ -278,102 +855,110 @@ FileHandle* SimpleFS_openFile(DirectoryHandle* d, const char* filename){
 	// security check on input args
 	if(!d || !filename) return NULL;
 
-	// file handle allocation
-	FileHandle * file_handle = (FileHandle*) malloc(sizeof(FileHandle));
-	
-	// first directory block pointer
-	FirstDirectoryBlock * db = d->dcb;
+	int block = SimpleFS_findEntry(d->sfs, d->dcb, filename, 0);
+	if(block == -1) return NULL;
 
-	int i, dim_array = 0; 
-	for(i = 0; i < d->dcb->num_entries; i++, dim_array++){
-		
-		// if the array is finished
-		if(dim_array >= sizeof(db->file_blocks)){
-			
-			DirectoryBlock* db;
-			
-			// updates relative index
-			dim_array = dim_array - sizeof(db->file_blocks);
-			
-			// reads the next directory block
-			DiskDriver_readBlock(d->sfs->disk, db, db->header.next_block);
-		}
-		
-		// retrieves the first file block in db->file_blocks[dim_array]
-		FirstFileBlock * ffb = (FirstFileBlock*) malloc(sizeof(FirstFileBlock));
-		DiskDriver_readBlock(d->sfs->disk, ffb, db->file_blocks[dim_array]);
-		
-		// compares the names of the files and checks if is not a directory
-		if(strcmp(ffb->fcb.name, filename) == 0 && ffb->fcb.is_dir == 0){
+	return SimpleFS_openBlock(d->sfs, block, d->dcb);
+}
 
-			// initializes file_handle
-			file_handle->sfs = d->sfs;
-			file_handle->fcb = ffb;
-			file_handle->directory = d->dcb;
-			file_handle->current_block = &(ffb->header);
-			file_handle->pos_in_file = 0;
 
-			
-			return file_handle;
-		}
-	}
+// opens a file in the directory d as SimpleFS_openFile, with flags (SIMPLEFS_APPEND)
+FileHandle* SimpleFS_openFileFlags(DirectoryHandle* d, const char* filename, int flags){
+
+	// security check on input args
+	if(flags & ~SIMPLEFS_APPEND) return NULL;
 
-	return NULL;
+	FileHandle* f = SimpleFS_openFile(d, filename);
+	if(f) f->flags = flags;
+
+	return f;
 }
 
 
-// closes a file handle (destroyes it)
-int SimpleFS_close(FileHandle* f) {
+// frees the blocks reserved for the growth of the file fcb and not used
+static int SimpleFS_freePrealloc(SimpleFS* fs, FileControlBlock* fcb){
 
-	// security check
-	if(!f) return 0;
-	free(f->fcb);
-	free(f);
+	if(fcb->prealloc_blocks == 0) return 0;
 
-	return 0;
+	ArenaMark mark = Arena_mark(&fs->scratch);
+	int* blocks = (int*) Arena_alloc(&fs->scratch, fcb->prealloc_blocks * sizeof(int));
+	if(!blocks) return -1;
+
+	int i;
+	for(i = 0; i < fcb->prealloc_blocks; i++) blocks[i] = fcb->prealloc_block + i;
+	int ret = BlockCache_freeBlocks(&fs->cache, blocks, fcb->prealloc_blocks);
+	Arena_release(&fs->scratch, mark);
+
+	fcb->prealloc_block = -1;
+	fcb->prealloc_blocks = 0;
+	return ret;
 }
 
 
-// checks if a directory already exists and returns the block index
-int SimpleFS_findDir(DirectoryHandle* d, const char* dirname){
+// returns 1 if the first block of f still holds the file, and the file wasn't removed
+// a handle left open on a removed file doesn't write its control block back:
+// the block carries the stamp for SimpleFS_reclaim, or already holds another file
+static int SimpleFS_isLive(FileHandle* f){
 
-	// security check on input args
-	if(!d || !dirname) return 0;
-	
-	// first directory block pointer
-	FirstDirectoryBlock * db = d->dcb;
+	SimpleFS* fs = f->sfs;
+	const FileControlBlock* fcb = &f->fcb->fcb;
+	if(DiskDriver_getFreeBlock(fs->disk, fcb->block_in_disk) == fcb->block_in_disk) return 0;
 
-	FirstFileBlock * ffb = (FirstFileBlock*) malloc(sizeof(FirstFileBlock));
-	
-	int i, dim_array = 0; 
-	for(i = 0; i < d->dcb->num_entries; i++, dim_array++){
-		
-		// if the array is finished
-		if(dim_array >= sizeof(db->file_blocks)){
-			
-			DirectoryBlock* db;
-			
-			// updates relative index
-			dim_array = dim_array - sizeof(db->file_blocks);
-			
-			// reads the next directory block
-			DiskDriver_readBlock(d->sfs->disk, db, db->header.next_block);
-		}
-		
-		// retrieves the first file block in db->file_blocks[dim_array]
-		ffb = (FirstFileBlock*) malloc(sizeof(FirstFileBlock));
-		DiskDriver_readBlock(d->sfs->disk, ffb, db->file_blocks[dim_array]);
-		
-		// compares the names of the files and checks if is not a directory
-		if(strcmp(ffb->fcb.name, dirname) == 0 && ffb->fcb.is_dir == 1){
-			int block = ffb->fcb.block_in_disk;
-			free(ffb);
-			return block;
-		}
+	const FirstFileBlock* ffb = (const FirstFileBlock*) BlockCache_getBlock(&fs->cache, fcb->block_in_disk);
+	if(!ffb) return 0;
+	int live = ffb->header.block_in_file == 0 && ffb->fcb.block_in_disk == fcb->block_in_disk && ffb->fcb.removed_stamp == 0 &&
+		ffb->fcb.directory_block == fcb->directory_block && strcmp(ffb->fcb.name, fcb->name) == 0;
+	BlockCache_putBlock(&fs->cache, ffb);
+
+	return live;
+}
+
+
+// closes a file handle (destroyes it)
+// the blocks reserved for the growth of the file and not written are given back
+int SimpleFS_close(FileHandle* f) {
+
+	// security check
+	if(!f) return 0;
+
+	SimpleFS* fs = f->sfs;
+	FileControlBlock* fcb = &f->fcb->fcb;
+	int ret = 0;
+
+	// a removed file keeps its window, SimpleFS_reclaim frees it with the rest
+	if(fcb->prealloc_blocks && SimpleFS_isLive(f)) {
+		ret = SimpleFS_freePrealloc(fs, fcb);
+		BlockCache_writeBlock(&fs->cache, f->fcb, fcb->block_in_disk);
+		BlockCache_sync(&fs->cache);
 	}
+
+	Slab_free(&f->sfs->buffers, f->fcb);
+	Slab_free(&f->sfs->file_handles, f);
+
+	return ret;
+}
+
+
+// closes a directory handle, with its copies of the directory and of its parent
+int SimpleFS_closeDir(DirectoryHandle* d) {
+
+	// security check
+	if(!d) return 0;
+	Slab_free(&d->sfs->buffers, d->dcb);
+	Slab_free(&d->sfs->buffers, d->directory);
+	Slab_free(&d->sfs->dir_handles, d);
+
+	return 0;
+}
+
+
+// checks if a directory already exists and returns the block index
+int SimpleFS_findDir(DirectoryHandle* d, const char* dirname){
+
+	// security check on input args
+	if(!d || !dirname) return 0;
 	
-	free(ffb);
-	return -1;
+	return SimpleFS_findEntry(d->sfs, d->dcb, dirname, 1);
 }
 
 // creates a new directory in the current one (stored in fs->current_directory_block)
@@ -384,8 +969,9 @@ int SimpleFS_mkDir(DirectoryHandle* d, char* dirname){
 	// security check on input args
 	if(!d || !dirname) return -1;
 
-	// security check on free blocks
-	if(d->sfs->disk->header->free_blocks <= 1){
+	// security check on free blocks: the first block of the directory, a new directory block,
+	// and the table and a bucket block of the hash table of its parent
+	if(!SimpleFS_ensureFree(d->sfs, 4)){
 		printf("\nThe disk is full\n");
 		return -1; 
 	}
@@ -394,121 +980,38 @@ int SimpleFS_mkDir(DirectoryHandle* d, char* dirname){
 	if(SimpleFS_findDir(d,dirname) != -1) return -1;
 
 	// first directory block allocation
-	FirstDirectoryBlock * fdb = (FirstDirectoryBlock*) malloc(sizeof(FirstDirectoryBlock));
+	FirstDirectoryBlock * fdb = (FirstDirectoryBlock*) Slab_alloc(&d->sfs->buffers);
+	if(!fdb) return -1;
 	fdb->header.previous_block = -1;
 	fdb->header.next_block = -1;
 	fdb->header.block_in_file = 0;
 	fdb->fcb.directory_block = d->dcb->fcb.block_in_disk;
-	fdb->fcb.block_in_disk = DiskDriver_getFreeBlock(d->sfs->disk, 0);
+	fdb->fcb.block_in_disk = d->sfs->disk->header->first_free_block;
 	strcpy(fdb->fcb.name, dirname);
 	fdb->fcb.size_in_bytes = 0;
 	fdb->fcb.size_in_blocks = 0;
 	fdb->fcb.is_dir = 1;
+	fdb->fcb.index_block = -1;
+	fdb->fcb.indirect_block = -1;
+	memset(fdb->fcb.extents, 0, sizeof(fdb->fcb.extents));
+	fdb->fcb.prealloc_block = -1;
+	fdb->fcb.prealloc_blocks = 0;
+	fdb->fcb.last_block = -1;
+	fdb->fcb.last_fill = 0;
+	fdb->fcb.removed_stamp = 0;
 	fdb->num_entries = 0;
-	memset(fdb->file_blocks, 0, sizeof(fdb->file_blocks));
+	memset(fdb->file_blocks, 0, d->sfs->fdb_entries*sizeof(int));
 	
-	DiskDriver_writeBlock(d->sfs->disk, fdb, fdb->fcb.block_in_disk);
+	BlockCache_writeBlock(&d->sfs->cache, fdb, fdb->fcb.block_in_disk);
 	
-	// checks if the directory is full
-	if(d->dcb->file_blocks[sizeof(d->dcb->file_blocks)-1] == 0){
-		
-		//~ printf("\n\nThere's free space in first directory block\n\n");
-
-		// finds the first free index in file_blocks
-		int i;
-		for(i = 0; d->dcb->file_blocks[i] != 0; i++) {}
-
-		// updates directory control block info
-		d->dcb->file_blocks[i] = fdb->fcb.block_in_disk;	
-		d->dcb->num_entries++;
-
-		// update the new info in disk
-		DiskDriver_writeBlock(d->sfs->disk, d->dcb, d->dcb->fcb.block_in_disk);
-		
-	}else{
-		
-		DirectoryBlock* db = (DirectoryBlock*) malloc(sizeof(DirectoryBlock));
-		
-		// first directory block has a next directory block
-		if(d->dcb->header.next_block != -1){
-			
-			// looks for a free directory block or a to-be-created directory block
-			DiskDriver_readBlock(d->sfs->disk, db, d->dcb->header.next_block);
-			int curr_block = d->dcb->header.next_block;
-			while(db->file_blocks[sizeof(db->file_blocks)-1] != 0 && db->header.next_block != -1){
-				
-				curr_block = db->header.next_block;
-				DiskDriver_readBlock(d->sfs->disk, db, db->header.next_block);
-			}
-			
-			// directory block is free
-			if(db->file_blocks[sizeof(db->file_blocks)-1] == 0){
-				//~ printf("\n\nThere's free space in directory block %d\n\n", curr_block);
-
-				// finds the first free index in file_blocks
-				int i;
-				for(i = 0; db->file_blocks[i] != 0; i++) {}
-
-				// updates directory control block info
-				db->file_blocks[i] = fdb->fcb.block_in_disk;	
-				d->dcb->num_entries++;
-
-				// update the new info in disk
-				DiskDriver_writeBlock(d->sfs->disk, db, curr_block);
-			}
-			
-			// next directory block doesn't exist
-			else if(db->header.next_block == -1){
-				//~ printf("\n\nCreating a new directory block because %d is full and has no next block, next block position = %d\n\n", curr_block, d->sfs->disk->header->first_free_block);
-
-				// creates new directory block
-				int free_block = d->sfs->disk->header->first_free_block;
-				DirectoryBlock* new_db = (DirectoryBlock*) malloc(sizeof(DirectoryBlock));
-				new_db->header.block_in_file = db->header.block_in_file+1;
-				new_db->header.next_block = -1;
-				new_db->header.previous_block = curr_block;
-				
-				db->header.next_block = free_block;
-				DiskDriver_writeBlock(d->sfs->disk, db, curr_block);
-				
-				// updates directory control block info
-				db->file_blocks[0] = fdb->fcb.block_in_disk;	
-				d->dcb->num_entries++;
-
-				// update the new info in disk
-				DiskDriver_writeBlock(d->sfs->disk, new_db, free_block);
-				free(new_db);				
-			}
-		}
-		else{
-			
-			//~ printf("\n\nCreating a new directory block because the first one is full and has no next block, next block position = %d\n\n", d->sfs->disk->header->first_free_block);
-			
-			// creates new directory block
-			int free_block = d->sfs->disk->header->first_free_block;
-			DirectoryBlock* new_db = (DirectoryBlock*) malloc(sizeof(DirectoryBlock));
-			new_db->header.block_in_file = db->header.block_in_file+1;
-			new_db->header.next_block = -1;
-			new_db->header.previous_block = d->dcb->fcb.block_in_disk;
-				
-			d->dcb->header.next_block = free_block;
-			DiskDriver_writeBlock(d->sfs->disk, d->dcb, d->dcb->fcb.block_in_disk);
-			
-			// updates directory control block info
-			db->file_blocks[0] = fdb->fcb.block_in_disk;	
-			d->dcb->num_entries++;
-
-			// update the new info in disk
-			DiskDriver_writeBlock(d->sfs->disk, new_db, free_block);
-			free(new_db);
-		}
-		free(db);	
-	}
+	// adds the directory to its parent, or gives its block back
+	int ret = SimpleFS_addEntry(d, fdb->fcb.block_in_disk, dirname, 1);
+	if(ret == -1) BlockCache_freeBlock(&d->sfs->cache, fdb->fcb.block_in_disk);
 
-	free(fdb);
-	DiskDriver_flush(d->sfs->disk);
+	Slab_free(&d->sfs->buffers, fdb);
+	BlockCache_sync(&d->sfs->cache);
 
-	return 0;
+	return ret;
 }
 
 
@@ -531,18 +1034,16 @@ int SimpleFS_changeDir(DirectoryHandle* d, char* dirname) {
 		}
 		else{
 			
-			free(d->dcb);
+			Slab_free(&d->sfs->buffers, d->dcb);
 			
 			//updates directory handle
 			d->dcb = d->directory;
-			d->current_block = &(d->dcb->header);
-			d->pos_in_dir = 0;
-			d->pos_in_block = d->dcb->fcb.block_in_disk;
+			SimpleFS_rewindDir(d);
 			
 			if(strcmp(d->dcb->fcb.name, "/") != 0){
 				
-				FirstDirectoryBlock* parent = (FirstDirectoryBlock*) malloc(sizeof(FirstDirectoryBlock));
-				DiskDriver_readBlock(d->sfs->disk, parent, d->dcb->fcb.directory_block);
+				FirstDirectoryBlock* parent = (FirstDirectoryBlock*) Slab_alloc(&d->sfs->buffers);
+				BlockCache_readBlock(&d->sfs->cache, parent, d->dcb->fcb.directory_block);
 				d->directory = parent;
 			}
 			else{
@@ -558,17 +1059,16 @@ int SimpleFS_changeDir(DirectoryHandle* d, char* dirname) {
 		// checks if dirname exists
 	 	if(index != -1){
 			
-			FirstDirectoryBlock* child = (FirstDirectoryBlock*) malloc(sizeof(FirstDirectoryBlock));
-			DiskDriver_readBlock(d->sfs->disk, child, index);
+			FirstDirectoryBlock* child = (FirstDirectoryBlock*) Slab_alloc(&d->sfs->buffers);
+			if(!child) return -1;
+			BlockCache_readBlock(&d->sfs->cache, child, index);
 			
-			free(d->directory);
+			Slab_free(&d->sfs->buffers, d->directory);
 			 
 			//updates directory handle
 			d->directory = d->dcb;
 			d->dcb = child;
-			d->current_block = &(d->dcb->header);
-			d->pos_in_dir = 0;
-			d->pos_in_block = index;
+			SimpleFS_rewindDir(d);
 			return 0;
 		}else{
 			
@@ -578,6 +1078,249 @@ int SimpleFS_changeDir(DirectoryHandle* d, char* dirname) {
 }
 
 
+// finds the IndexBlock and the entry recording the block in position index (> 0) of the file f
+// with create set, the missing index blocks are allocated (f->fcb is written by the caller)
+// returns the IndexBlock, -1 if it doesn't exist or can't be allocated
+static int SimpleFS_indexEntry(FileHandle* f, int index, int* slot, int create){
+
+	SimpleFS* fs = f->sfs;
+	FileControlBlock* fcb = &f->fcb->fcb;
+	int entries = fs->index_entries;
+
+	// blocks 1 .. entries are in the direct index
+	if(index <= entries) {
+		if(fcb->index_block == -1 && create) fcb->index_block = SimpleFS_newIndex(fs);
+		*slot = index - 1;
+		return fcb->index_block;
+	}
+
+	// the following ones in the index blocks listed by the indirect index
+	int i = index - 1 - entries;
+	if(i / entries >= entries) return -1;
+
+	if(fcb->indirect_block == -1 && create) fcb->indirect_block = SimpleFS_newIndex(fs);
+	if(fcb->indirect_block == -1) return -1;
+
+	const IndexBlock* indirect = (const IndexBlock*) BlockCache_getBlock(&fs->cache, fcb->indirect_block);
+	if(!indirect) return -1;
+	int table_block = indirect->blocks[i / entries];
+	BlockCache_putBlock(&fs->cache, indirect);
+
+	if(table_block == -1 && create) {
+		table_block = SimpleFS_newIndex(fs);
+		if(table_block == -1) return -1;
+
+		IndexBlock* pinned = (IndexBlock*) BlockCache_pinBlock(&fs->cache, fcb->indirect_block);
+		if(!pinned) return -1;
+		pinned->blocks[i / entries] = table_block;
+		if(BlockCache_commitBlock(&fs->cache, pinned, fcb->indirect_block) == -1) return -1;
+	}
+
+	*slot = i % entries;
+	return table_block;
+}
+
+
+// returns the block in position index of the file f according to its extents and its index
+// -1 if they don't record it, the block is then reached through the chain
+static int SimpleFS_blockAt(FileHandle* f, int index){
+
+	if(index == 0) return f->fcb->fcb.block_in_disk;
+
+	// the extents cover the blocks from 1 in order
+	const Extent* extents = f->fcb->fcb.extents;
+	int i, first = 1;
+	for(i = 0; i < SIMPLEFS_EXTENTS && extents[i].length; i++) {
+		if(index < first + extents[i].length) return extents[i].block + index - first;
+		first += extents[i].length;
+	}
+
+	int slot;
+	int table_block = SimpleFS_indexEntry(f, index, &slot, 0);
+	if(table_block == -1) return -1;
+
+	const IndexBlock* table = (const IndexBlock*) BlockCache_getBlock(&f->sfs->cache, table_block);
+	if(!table) return -1;
+	int block_num = table->blocks[slot];
+	BlockCache_putBlock(&f->sfs->cache, table);
+
+	return block_num;
+}
+
+
+// records in the index of the file f that the n blocks in block_nums are in position index and the following ones
+// the entries falling in the same IndexBlock are written together
+// returns -1 if the index can't grow, the file is then followed through its chain from there
+static int SimpleFS_setBlocksAt(FileHandle* f, int index, const int* block_nums, int n){
+
+	int i = 0;
+	while(i < n) {
+		int slot;
+		int table_block = SimpleFS_indexEntry(f, index + i, &slot, 1);
+		if(table_block == -1) return -1;
+
+		IndexBlock* table = (IndexBlock*) BlockCache_pinBlock(&f->sfs->cache, table_block);
+		if(!table) return -1;
+		for(; i < n && slot < f->sfs->index_entries; i++, slot++) table->blocks[slot] = block_nums[i];
+
+		if(BlockCache_commitBlock(&f->sfs->cache, table, table_block) == -1) return -1;
+	}
+
+	return 0;
+}
+
+
+// records in the extents of the file f that the block block_num is in position index
+// the blocks must be added in order, extending the last extent when contiguous
+// returns -1 if the extents don't reach index or are all used, the block then goes in the index
+static int SimpleFS_addExtent(FileHandle* f, int index, int block_num){
+
+	Extent* extents = f->fcb->fcb.extents;
+	int i, first = 1;
+	for(i = 0; i < SIMPLEFS_EXTENTS && extents[i].length; i++) first += extents[i].length;
+
+	// only the block right after the extents can be added
+	if(index != first) return -1;
+
+	if(i > 0 && extents[i-1].block + extents[i-1].length == block_num) {
+		extents[i-1].length++;
+		return 0;
+	}
+	if(i == SIMPLEFS_EXTENTS) return -1;
+
+	extents[i].block = block_num;
+	extents[i].length = 1;
+	return 0;
+}
+
+
+// returns a block for the growth of the file f, taken from its preallocation window
+// when the window is used up a new one is reserved, of needed blocks plus as many as the file has
+// (at most SIMPLEFS_PREALLOC_MAX), preferably from goal to continue the last run of the file
+// returns -1 if the disk is full
+static int SimpleFS_allocBlock(FileHandle* f, int goal, int needed){
+
+	DiskDriver* disk = f->sfs->disk;
+	FileControlBlock* fcb = &f->fcb->fcb;
+
+	if(fcb->prealloc_blocks == 0) {
+
+		// a full disk first gives back the blocks of the removed files
+		if(!SimpleFS_ensureFree(f->sfs, 1)) return -1;
+
+		// the window grows with the file
+		int want = needed + fcb->size_in_blocks;
+		if(want > SIMPLEFS_PREALLOC_MAX) want = SIMPLEFS_PREALLOC_MAX;
+
+		// continues the run of the file if the blocks after it are free
+		int start = goal, len = DiskDriver_getFreeLength(disk, goal, want);
+
+		// otherwise looks for a run as long as wanted, or shorter ones
+		for(; len == 0 && want > 0; want /= 2) {
+			start = DiskDriver_getFreeRun(disk, goal, want);
+			if(start == -1) start = DiskDriver_getFreeRun(disk, 0, want);
+			if(start != -1) len = want;
+		}
+		if(len == 0 || DiskDriver_reserveBlocks(disk, start, len) == -1) return -1;
+
+		fcb->prealloc_block = start;
+		fcb->prealloc_blocks = len;
+	}
+
+	int block_num = fcb->prealloc_block;
+	fcb->prealloc_blocks--;
+	fcb->prealloc_block = fcb->prealloc_blocks ? block_num + 1 : -1;
+	return block_num;
+}
+
+
+// moves the cursor of f to the end of the file, recorded in its control block
+static void SimpleFS_cursorToEnd(FileHandle* f){
+
+	FileControlBlock* fcb = &f->fcb->fcb;
+	f->cursor_block = fcb->last_block;
+	f->cursor_index = fcb->size_in_blocks ? fcb->size_in_blocks - 1 : 0;
+	f->pos_in_block = fcb->last_fill;
+	f->pos_in_file = fcb->size_in_bytes;
+}
+
+
+// moves the cursor of f to the byte pos, to the end of the file at once, else through the index of the file if any
+// otherwise following the chain from the block of the cursor
+// a cursor between two blocks stays at the end of the first one
+// returns -1 if the chain is shorter than pos, leaving the cursor where it was
+static int SimpleFS_moveCursor(FileHandle* f, int pos){
+
+	SimpleFS* fs = f->sfs;
+
+	if(pos == f->fcb->fcb.size_in_bytes) {
+		SimpleFS_cursorToEnd(f);
+		return 0;
+	}
+
+	// block of the file and offset in the block of pos
+	int index = 0, offset = pos;
+	if(pos > fs->ffb_data_size) {
+		index = 1 + (pos - fs->ffb_data_size - 1) / fs->fb_data_size;
+		offset = pos - fs->ffb_data_size - (index - 1) * fs->fb_data_size;
+	}
+
+	// the index gives the block at once
+	int indexed = index != f->cursor_index ? SimpleFS_blockAt(f, index) : -1;
+	if(indexed != -1) {
+		f->cursor_block = indexed;
+		f->cursor_index = index;
+		f->pos_in_block = offset;
+		f->pos_in_file = pos;
+		return 0;
+	}
+
+	// walking back from the cursor is worth only if closer than the first block
+	int block_num = f->cursor_block, current = f->cursor_index;
+	if(index < current - index) {
+		block_num = f->fcb->fcb.block_in_disk;
+		current = 0;
+	}
+
+	int backward = index < current;
+	while(current != index) {
+
+		// the first block is the copy in the handle
+		int next_block, prev_block;
+		if(current == 0) {
+			next_block = f->fcb->header.next_block;
+			prev_block = -1;
+		}
+		else {
+			const BlockHeader* header = (const BlockHeader*) BlockCache_getBlock(&fs->cache, block_num);
+			if(!header) return -1;
+
+			// a block not in its place means a broken previous_block, restarts from the first block
+			if(backward && header->block_in_file != current) {
+				BlockCache_putBlock(&fs->cache, header);
+				block_num = f->fcb->fcb.block_in_disk;
+				current = 0;
+				backward = 0;
+				continue;
+			}
+			next_block = header->next_block;
+			prev_block = header->previous_block;
+			BlockCache_putBlock(&fs->cache, header);
+		}
+
+		block_num = backward ? prev_block : next_block;
+		current += backward ? -1 : 1;
+		if(block_num == -1) return -1;
+	}
+
+	f->cursor_block = block_num;
+	f->cursor_index = index;
+	f->pos_in_block = offset;
+	f->pos_in_file = pos;
+	return 0;
+}
+
+
 // returns the number of bytes read (moving the current pointer to pos)
 // returns pos on success
 // -1 on error (file too short)
@@ -586,504 +1329,1189 @@ int SimpleFS_seek(FileHandle* f, int pos) {
 	// security check on input args
 	if(!f || pos < 0 || pos > f->fcb->fcb.size_in_bytes) return -1;
 
-	// scans each block of the file
-	int weight = 0;
-	FirstFileBlock * ffb = (FirstFileBlock*) malloc(sizeof(FirstFileBlock));
-	DiskDriver_readBlock(f->sfs->disk, ffb, f->fcb->fcb.block_in_disk);
-	
-	// computes the weight of the file
-	weight += sizeof(ffb->data);
-	if(ffb->header.next_block != -1) {
-		
-		FileBlock * file = (FileBlock*) malloc(sizeof(FileBlock));
-		DiskDriver_readBlock(f->sfs->disk, file, ffb->header.next_block);
-		
-		weight += sizeof(file->data);
-		while(file->header.next_block != -1) {
-			
-			DiskDriver_readBlock(f->sfs->disk, file, file->header.next_block);
-			weight += sizeof(file->data);
-		}
-		
-		free(file);
-	}
-	free(ffb);
-	// file is too short
-	if(pos > weight){
-		
-		return -1;
-	}else{
-		
-		// updates the file current pointer
-		f->pos_in_file = pos;
-		return pos;
-	}
+	// moves only across the blocks between the cursor and pos
+	if(SimpleFS_moveCursor(f, pos) == -1) return -1;
 
+	return pos;
 }
 
 
 // reads in the file, at current position size bytes stored in data
-// returns the number of bytes read
+// the bytes are copied as they are, without looking for a string terminator
+// returns the number of bytes read, moving the cursor after them
 int SimpleFS_read(FileHandle* f, void* info, int size) {
 
 	// security check on input args
 	if(!f || !info || f->pos_in_file > f->fcb->fcb.size_in_bytes || size < 0) return -1;
 
-	// initializes data
+	// reads at most up to the end of the file
+	int remaining = f->fcb->fcb.size_in_bytes - f->pos_in_file;
+	if(size > remaining) size = remaining;
+
 	char* data = (char*) info;
-	memset(data, '\0', size);
+	BlockCache* cache = &f->sfs->cache;
 
-	// Memorizzo il primo blocco del file da leggere
-	FirstFileBlock* ffb = (FirstFileBlock*) malloc(sizeof(FirstFileBlock));
-	DiskDriver_readBlock(f->sfs->disk, ffb, f->fcb->fcb.block_in_disk);
-	
-	// reads only the first block
-	if(size <= strlen(ffb->data)) {
-		
-		strcpy(data, ffb->data);
+	// starts from the block of the cursor, the first one is the copy in the handle
+	const char* payload = f->fcb->data;
+	int payload_size = f->sfs->ffb_data_size;
+	int next_block = f->fcb->header.next_block;
+	const FileBlock* file = NULL;
+
+	if(f->cursor_index != 0) {
+		file = (const FileBlock*) BlockCache_getBlock(cache, f->cursor_block);
+		if(!file) return -1;
+
+		payload = file->data;
+		payload_size = f->sfs->fb_data_size;
+		next_block = file->header.next_block;
 	}
-	else{
-		strcpy(data, ffb->data);
-		
-		// scans each file block until data's size reaches size
-		FileBlock* file = (FileBlock*) malloc(sizeof(FileBlock));
 
-		int next_block = f->fcb->header.next_block;
-		
-		while(next_block != -1) {
-			DiskDriver_readBlock(f->sfs->disk, file, next_block);
-			
-			// data += file->data
-			sprintf(data, "%s%s", data, file->data);
-			
+	// block and offset of the cursor
+	int block_num = f->cursor_block, index = f->cursor_index;
+	int offset = f->pos_in_block;
+
+	// copies block by block, the next blocks are read in place
+	int bytes_r = 0;
+	while(bytes_r < size) {
+
+		// moves to the next block when the cursor is past the current one
+		if(offset >= payload_size) {
+
+			if(file) BlockCache_putBlock(cache, file);
+			file = (const FileBlock*) BlockCache_getBlock(cache, next_block);
+			if(!file) break;
+
+			block_num = next_block;
+			index++;
+			offset -= payload_size;
+			payload = file->data;
+			payload_size = f->sfs->fb_data_size;
 			next_block = file->header.next_block;
+			continue;
 		}
-		
-		free(file);
+
+		int len = payload_size - offset < size - bytes_r ? payload_size - offset : size - bytes_r;
+		memcpy(data + bytes_r, payload + offset, len);
+		bytes_r += len;
+		offset += len;
 	}
-	
-	free(ffb);
-	// returns using strlen because data is char*
-	return strlen(data);
-}
 
+	if(file) BlockCache_putBlock(cache, file);
 
-// adds a new FileBlock
-int SimpleFS_addFileBlock(DiskDriver* disk, FileBlock* new_file_block, FileBlock* parent){
-	
-	// security check on input args
-	if(!disk || !new_file_block || !parent || disk->header->free_blocks <= 1){
-		return -1;
-	}
-	
-	// initializes new_file_block
-	new_file_block->header.block_in_file = parent->header.block_in_file+1;
-	new_file_block->header.next_block = -1;
-	
-	// retrieves and insert the previous block index
-	DiskDriver_readBlock(disk, parent, new_file_block->header.previous_block);
-	new_file_block->header.previous_block = parent->header.next_block;
-	
-	parent->header.next_block = disk->header->first_free_block;
-	
-	// writes the new block and updates the previous on disk
-	DiskDriver_writeBlock(disk, parent, new_file_block->header.previous_block);
-	DiskDriver_writeBlock(disk, new_file_block, disk->header->first_free_block);
-	DiskDriver_flush(disk);
+	// the cursor follows the bytes read
+	f->pos_in_file += bytes_r;
+	f->cursor_block = block_num;
+	f->cursor_index = index;
+	f->pos_in_block = offset;
+	return bytes_r;
 }
 
 
 // writes in the file, at current position for size bytes stored in data
 // overwriting and allocating new space if necessary
+// the blocks are filled in place in the cache from the cursor, each one written once,
+// and the file control block once at the end
 // returns the number of bytes written
 int SimpleFS_write(FileHandle* f, void* data, int size) {
 
 	// security check on input args
 	if(!f || !data || f->pos_in_file > f->fcb->fcb.size_in_bytes || size < 0 ) return -1;
 
-	// bytes written to be returned and blocks written counter
-	int bytes_w = 0, blocks_w = 0;
+	// a removed file isn't written anymore
+	if(!SimpleFS_isLive(f)) return -1;
 
-	// cursor in file
-	int pos = f->pos_in_file;
-	
-	// updates the current position in data
-	f->pos_in_file = (int) (f->pos_in_file + size);
-	
-	// counter of memory read from the first file block
-	int ctr = sizeof(f->fcb->data);
-	
-	// if fits in the first file block
-	if(size + pos < ctr){
-		
-		// writes all data starting from pos
-		memcpy(f->fcb->data+pos, data, size);
-		bytes_w = size;
-		blocks_w = 1;
+	SimpleFS* fs = f->sfs;
+	BlockCache* cache = &fs->cache;
+	char* src = (char*) data;
+
+	// an append starts from the end of the file, without following the chain
+	if(f->flags & SIMPLEFS_APPEND) SimpleFS_cursorToEnd(f);
+
+	// starts from the block of the cursor, the first one is the copy in the handle
+	int block_num = f->cursor_block, index = f->cursor_index;
+	int offset = f->pos_in_block;
+
+	FileBlock* file_block = NULL;
+	if(index != 0) {
+		file_block = (FileBlock*) BlockCache_pinBlock(cache, block_num);
+		if(!file_block) return -1;
 	}
-	//if starts from ffb
-	else if(pos < ctr){
-		
-		// fills the ffb 
-		memcpy(f->fcb->data+pos, data, ctr-pos);
-		bytes_w += ctr-pos;
-		blocks_w = 1;
-		
-		FileBlock* file_block = (FileBlock*) malloc(sizeof(FileBlock));
-		
-		// if next block exists reads it
-		if(DiskDriver_readBlock(f->sfs->disk, file_block, f->current_block->next_block) != -1){}
-		// if not creates it
-		else{
-			
-			// adds a new file block linked to the first one
-			f->current_block->next_block = f->sfs->disk->header->first_free_block;
-			file_block->header.next_block = -1;
-			file_block->header.previous_block = f->fcb->fcb.block_in_disk;
-			file_block->header.block_in_file = f->current_block->block_in_file+1;
-			
-			// updates the first one on disk
-			DiskDriver_writeBlock(f->sfs->disk, f->fcb, f->fcb->fcb.block_in_disk);
-		}
-		
-		// if fits entirely in the block writes all data
-		if((size - bytes_w) < sizeof(file_block->data)){
-					
-			memcpy(file_block->data, data+bytes_w, (size - bytes_w));
-			bytes_w += (size - bytes_w);
-		}
-		// or fills the current block
-		else{
-					
-			memcpy(file_block->data, data+bytes_w, sizeof(file_block->data) - (size - bytes_w));
-			bytes_w += sizeof(file_block->data) - (size - bytes_w);
-		}
-				
-		blocks_w++;
-		// writes the new block if just created on disk, or updates it
-		DiskDriver_writeBlock(f->sfs->disk, file_block, f->current_block->next_block);
-		
-		FileBlock * prev_block = (FileBlock*) malloc(sizeof(FileBlock));
-		DiskDriver_readBlock(f->sfs->disk, prev_block, f->fcb->fcb.block_in_disk);
-		
-		// until writes all data
-		while(bytes_w < size){
-					
-			// if next block exists reads it				
-			if(DiskDriver_readBlock(f->sfs->disk, file_block, file_block->header.next_block) != -1){}
-			// if not creates it
-			else{
-					
-				file_block = (FileBlock*) malloc(sizeof(FileBlock));
-				if(SimpleFS_addFileBlock(f->sfs->disk, file_block, prev_block) == -1)	return-1;
-				
-			}
-					
-			DiskDriver_readBlock(f->sfs->disk, prev_block, prev_block->header.next_block);
-					
-			// if fits entirely in the block writes all data
-			if((size - bytes_w) < sizeof(file_block->data)){
-					
-				memcpy(file_block->data, data+bytes_w, (size - bytes_w));
-				bytes_w += (size - bytes_w);
+
+	// the blocks added beyond the extents go in the index together at the end
+	ArenaMark mark = Arena_mark(&fs->scratch);
+	int* indexed = NULL;
+	int first_indexed = 0, num_indexed = 0;
+
+	int bytes_w = 0;
+	while(bytes_w < size) {
+
+		int payload_size = index ? fs->fb_data_size : fs->ffb_data_size;
+
+		// moves to the next block when the current one is full
+		if(offset >= payload_size) {
+
+			BlockHeader* header = index ? &file_block->header : &f->fcb->header;
+			int next_block = header->next_block, created = 0;
+
+			// appends a new block to the chain, next to the current one if possible
+			int needed = (size - bytes_w + fs->fb_data_size - 1) / fs->fb_data_size;
+			if(next_block == -1) {
+				next_block = SimpleFS_allocBlock(f, block_num + 1, needed);
+				if(next_block == -1) break;
+
+				header->next_block = next_block;
+				created = 1;
 			}
-			// or fills the current block
-			else{
-					
-				memcpy(file_block->data, data+bytes_w, sizeof(file_block->data) - (size - bytes_w));
-				bytes_w += sizeof(file_block->data) - (size - bytes_w);
+
+			// the block left is done
+			if(index != 0 && BlockCache_commitBlock(cache, file_block, block_num) == -1) {
+				file_block = NULL;
+				break;
 			}
-				
-			blocks_w++;
-			DiskDriver_writeBlock(f->sfs->disk, file_block, prev_block->header.next_block);	
-		}
-		
-		free(prev_block);
-		free(file_block);
-	}
-	// if doesn't start from ffb
-	else{
-		
-		FileBlock* file_block = (FileBlock*) malloc(sizeof(FileBlock));
-		DiskDriver_readBlock(f->sfs->disk, file_block, f->current_block->next_block);
-		ctr += sizeof(file_block->data);
 
-		FileBlock * prev_block = (FileBlock*) malloc(sizeof(FileBlock));
-		DiskDriver_readBlock(f->sfs->disk, prev_block, f->fcb->fcb.block_in_disk);
-			
-		// scans blocks until finds block containing pos
-		while(pos > ctr){
-			DiskDriver_readBlock(f->sfs->disk, prev_block, prev_block->header.next_block);
-				
-			DiskDriver_readBlock(f->sfs->disk, file_block, file_block->header.next_block);
-			ctr += sizeof(file_block->data);		
-		}
-		
-		// computes the offset of the cursor in the current block
-		int offset = pos-(ctr-sizeof(file_block->data));
-				
-		// if fits entirely in the current block		
-		if(size + offset < sizeof(file_block->data)){
-		
-			// writes all data starting from offset
-			memcpy(file_block->data+offset, data, size);
-			bytes_w = size;
-			blocks_w = 1;
-			
-			DiskDriver_writeBlock(f->sfs->disk, file_block, prev_block->header.next_block);	
-		}
-		else{
-				
-			// fills the current block	
-			memcpy(file_block->data+offset, file_block, sizeof(file_block->data)-offset);
-			
-			bytes_w = sizeof(file_block->data)-offset;
-			blocks_w++;
-			DiskDriver_writeBlock(f->sfs->disk, file_block, prev_block->header.next_block);	
-			
-			// until writes all data
-			while(bytes_w < size){
-					
-				// if next block exists reads it				
-				if(DiskDriver_readBlock(f->sfs->disk, file_block, file_block->header.next_block) != -1){}
-				// if not creates it
-				else{
-					
-					file_block = (FileBlock*) malloc(sizeof(FileBlock));
-					if(SimpleFS_addFileBlock(f->sfs->disk, file_block, prev_block) == -1)	return-1;
-				}
-					
-				DiskDriver_readBlock(f->sfs->disk, prev_block, prev_block->header.next_block);
-					
-				// if fits entirely in the block writes all data
-				if((size - bytes_w) < sizeof(file_block->data)){
-					
-					memcpy(file_block->data, data+bytes_w, (size - bytes_w));
-					bytes_w += (size - bytes_w);
+			// a new block is reserved by its preallocation window, its content on the disk is not read
+			file_block = (FileBlock*) (created ? BlockCache_pinNewBlock(cache, next_block) : BlockCache_pinBlock(cache, next_block));
+			if(!file_block) break;
+
+			if(created) {
+				file_block->header.previous_block = block_num;
+				file_block->header.next_block = -1;
+				file_block->header.block_in_file = index + 1;
+
+				// once a block goes in the index, the following ones can't extend the extents
+				if(num_indexed || SimpleFS_addExtent(f, index + 1, next_block) == -1) {
+					if(!indexed) {
+						indexed = (int*) Arena_alloc(&fs->scratch, needed * sizeof(int));
+						first_indexed = index + 1;
+					}
+					if(indexed) indexed[num_indexed++] = next_block;
 				}
-				// or fills the current block
-				else{
-					
-					memcpy(file_block->data, data+bytes_w, sizeof(file_block->data) - (size - bytes_w));
-					bytes_w += sizeof(file_block->data) - (size - bytes_w);
-				}
-				
-				blocks_w++;
-				DiskDriver_writeBlock(f->sfs->disk, file_block, prev_block->header.next_block);	
 			}
-			
-			free(prev_block);
-			free(file_block);
+
+			block_num = next_block;
+			index++;
+			offset = 0;
+			continue;
 		}
+
+		// fills the current block from the cursor
+		int len = payload_size - offset < size - bytes_w ? payload_size - offset : size - bytes_w;
+		memcpy((index ? file_block->data : f->fcb->data) + offset, src + bytes_w, len);
+		bytes_w += len;
+		offset += len;
 	}
-	
-	// updates fields and writes in disk
-	f->fcb->fcb.size_in_bytes = pos + size > f->fcb->fcb.size_in_bytes ? pos + size : f->fcb->fcb.size_in_bytes;
-	f->fcb->fcb.size_in_blocks = blocks_w;
-	
-	DiskDriver_writeBlock(f->sfs->disk, f->fcb, f->fcb->fcb.block_in_disk);
-	DiskDriver_flush(f->sfs->disk);
+
+	if(file_block) BlockCache_commitBlock(cache, file_block, block_num);
+	if(num_indexed) SimpleFS_setBlocksAt(f, first_indexed, indexed, num_indexed);
+	Arena_release(&fs->scratch, mark);
+
+	// the cursor follows the bytes written
+	f->pos_in_file += bytes_w;
+	f->cursor_block = block_num;
+	f->cursor_index = index;
+	f->pos_in_block = offset;
+
+	// updates fields and writes in disk, the end of the file follows the cursor when the file grows
+	if(f->pos_in_file >= f->fcb->fcb.size_in_bytes) {
+		f->fcb->fcb.last_block = block_num;
+		f->fcb->fcb.last_fill = offset;
+	}
+	if(f->pos_in_file > f->fcb->fcb.size_in_bytes) f->fcb->fcb.size_in_bytes = f->pos_in_file;
+	if(index + 1 > f->fcb->fcb.size_in_blocks) f->fcb->fcb.size_in_blocks = index + 1;
+
+	BlockCache_writeBlock(cache, f->fcb, f->fcb->fcb.block_in_disk);
+	BlockCache_sync(cache);
 	
 	return bytes_w;
 }
 
 
-// frees each block after the first file block(if file) or first directory block(if directory)
-void SimpleFS_free_file_dir(DiskDriver* disk, DirectoryHandle* d, FileHandle* f, int isDir){
-	
-	// if deletes a directory
-	if(isDir){
-		
-		// first directory block pointer
-		FirstDirectoryBlock * db = d->directory;
-		
-		int curr_block = db->fcb.block_in_disk;
-		
-		int i, dim_array = 0;
-		for(i = 0; i < d->directory->num_entries; i++, dim_array++) {
+// appends block to the array *blocks of *num_blocks blocks
+// the array, taken from the scratch arena with room for *max_blocks, is moved to a bigger one when full
+// (the old one is released with it)
+// returns -1 if the array can't grow
+static int SimpleFS_pushBlock(SimpleFS* fs, int** blocks, int* num_blocks, int* max_blocks, int block){
 
-			// if the array is finished
-			if(dim_array >= sizeof(db->file_blocks)) {
-				DirectoryBlock * db;
+	if(*num_blocks == *max_blocks) {
+		int* grown = (int*) Arena_alloc(&fs->scratch, 2 * *max_blocks * sizeof(int));
+		if(!grown) return -1;
 
-				// updates relative index
-				dim_array = dim_array - sizeof(db->file_blocks);
+		memcpy(grown, *blocks, *num_blocks * sizeof(int));
+		*blocks = grown;
+		*max_blocks *= 2;
+	}
+	(*blocks)[(*num_blocks)++] = block;
 
-				curr_block = db->header.next_block;
+	return 0;
+}
 
-				// reads the next directory block
-				DiskDriver_readBlock(d->sfs->disk, db, db->header.next_block);
-			}
-			
-			if(db->file_blocks[dim_array] == d->dcb->fcb.block_in_disk){
-				db->file_blocks[dim_array] = 0;
-				
-				while(db->file_blocks[dim_array+1]){
-					db->file_blocks[dim_array] = db->file_blocks[dim_array+1];
-					dim_array++;
-				}
-				db->file_blocks[dim_array] = 0;
-				
-				DiskDriver_writeBlock(disk, db, curr_block);
-				break;
-			}
-		
-		}
-		
-		d->directory->num_entries--;
-		
-		// updates d->directory->num_entries in disk
-		DiskDriver_writeBlock(disk, d->directory, d->directory->fcb.block_in_disk);
-		
-		DirectoryBlock* dir = (DirectoryBlock*) malloc(sizeof(DirectoryBlock));
 
-		int next_block = d->dcb->header.next_block;
-		
-		// frees every block of the directory
-		while(next_block != -1) {
-			DiskDriver_readBlock(d->sfs->disk, dir, next_block);
-			
-			DiskDriver_freeBlock(disk, next_block);
-			
-			next_block = dir->header.next_block;
+// appends the chain of blocks starting at next_block to the array *blocks (see SimpleFS_pushBlock)
+// returns -1 if the array can't grow
+static int SimpleFS_collectChain(SimpleFS* fs, int next_block, int** blocks, int* num_blocks, int* max_blocks){
+
+	BlockCache* cache = &fs->cache;
+
+	// follows the chain reading only the headers
+	while(next_block != -1) {
+		const BlockHeader* header = (const BlockHeader*) BlockCache_getBlock(cache, next_block);
+		if(!header) break;
+
+		if(SimpleFS_pushBlock(fs, blocks, num_blocks, max_blocks, next_block) == -1) {
+			BlockCache_putBlock(cache, header);
+			return -1;
 		}
-		
-		
-		DiskDriver_freeBlock(disk, d->dcb->fcb.block_in_disk);
-		DiskDriver_flush(disk);
-		free(dir);
-		
+
+		next_block = header->next_block;
+		BlockCache_putBlock(cache, header);
 	}
-	// if deletes a file
-	else{
-		
-		// first directory block pointer
-		FirstDirectoryBlock * db = f->directory;
-		
-		int curr_block = db->fcb.block_in_disk;
-		
-		int i, dim_array = 0;
-		for(i = 0; i < f->directory->num_entries; i++, dim_array++) {
 
-			// if the array is finished
-			if(dim_array >= sizeof(db->file_blocks)) {
-				DirectoryBlock * db;
+	return 0;
+}
 
-				// updates relative index
-				dim_array = dim_array - sizeof(db->file_blocks);
 
-				curr_block = db->header.next_block;
+// appends every block of the file ffb to the array *blocks (see SimpleFS_pushBlock)
+// its chain, its index blocks and its preallocation window
+// returns -1 if the array can't grow
+static int SimpleFS_collectFile(SimpleFS* fs, const FirstFileBlock* ffb, int** blocks, int* num_blocks, int* max_blocks){
 
-				// reads the next directory block
-				DiskDriver_readBlock(d->sfs->disk, db, db->header.next_block);
-			}
-			
-			if(db->file_blocks[dim_array] == f->fcb->fcb.block_in_disk){
-				db->file_blocks[dim_array] = 0;
-				
-				
-				while(db->file_blocks[dim_array+1]){
-					db->file_blocks[dim_array] = db->file_blocks[dim_array+1];
-					dim_array++;
-				}
-				db->file_blocks[dim_array] = 0;
-				
-				DiskDriver_writeBlock(disk, db, curr_block);
-				break;
-			}
-		}
-				
-		// updates d->dcb->num_entries in disk
-		f->directory->num_entries--;
-		DiskDriver_writeBlock(disk, f->directory, f->directory->fcb.block_in_disk);
-		
-		FileBlock* file = (FileBlock*) malloc(sizeof(FileBlock));
+	const FileControlBlock* fcb = &ffb->fcb;
+	int i, ret = SimpleFS_pushBlock(fs, blocks, num_blocks, max_blocks, fcb->block_in_disk);
+	if(ret != -1) ret = SimpleFS_collectChain(fs, ffb->header.next_block, blocks, num_blocks, max_blocks);
+
+	for(i = 0; i < fcb->prealloc_blocks && ret != -1; i++) {
+		ret = SimpleFS_pushBlock(fs, blocks, num_blocks, max_blocks, fcb->prealloc_block + i);
+	}
+
+	if(fcb->index_block != -1 && ret != -1) ret = SimpleFS_pushBlock(fs, blocks, num_blocks, max_blocks, fcb->index_block);
+	if(fcb->indirect_block == -1 || ret == -1) return ret;
+
+	ret = SimpleFS_pushBlock(fs, blocks, num_blocks, max_blocks, fcb->indirect_block);
+	const IndexBlock* indirect = (const IndexBlock*) BlockCache_getBlock(&fs->cache, fcb->indirect_block);
+	if(!indirect) return ret;
+
+	for(i = 0; i < fs->index_entries && ret != -1; i++) {
+		if(indirect->blocks[i] != -1) ret = SimpleFS_pushBlock(fs, blocks, num_blocks, max_blocks, indirect->blocks[i]);
+	}
+	BlockCache_putBlock(&fs->cache, indirect);
+
+	return ret;
+}
+
+
+// appends the hash table of the directory fcb and its bucket blocks to the array *blocks (see SimpleFS_pushBlock)
+// returns -1 if the array can't grow
+static int SimpleFS_collectHash(SimpleFS* fs, const FileControlBlock* fcb, int** blocks, int* num_blocks, int* max_blocks){
+
+	if(fcb->index_block == -1) return 0;
 
-		int next_block = f->fcb->header.next_block;
+	int ret = SimpleFS_pushBlock(fs, blocks, num_blocks, max_blocks, fcb->index_block);
+	const IndexBlock* table = (const IndexBlock*) BlockCache_getBlock(&fs->cache, fcb->index_block);
+	if(!table) return ret;
+
+	int i;
+	for(i = 0; i < fs->index_entries && ret != -1; i++) {
+		if(table->blocks[i] != -1) ret = SimpleFS_collectChain(fs, table->blocks[i], blocks, num_blocks, max_blocks);
+	}
+	BlockCache_putBlock(&fs->cache, table);
+
+	return ret;
+}
+
+
+// orders two block numbers, for qsort
+static int SimpleFS_compareBlocks(const void* a, const void* b){
+
+	int x = *(const int*) a, y = *(const int*) b;
+	return (x > y) - (x < y);
+}
+
+
+// frees the n blocks collected in blocks
+// they are sorted first, so that the bitmap is cleared a word at a time
+static int SimpleFS_freeSorted(SimpleFS* fs, int* blocks, int n){
+
+	qsort(blocks, n, sizeof(int), SimpleFS_compareBlocks);
+	return BlockCache_freeBlocks(&fs->cache, blocks, n);
+}
+
+
+// removes the entry block called name, a file (is_dir = 0) or a directory (is_dir = 1), from the directory dcb
+// from its hash table and from its entries, shifting the following entries of its directory block
+// the hint of the directory moves back to that block if it was after it
+// the dentry cache records that the name is not there anymore
+static void SimpleFS_removeEntry(SimpleFS* fs, FirstDirectoryBlock* dcb, int block, const char* name, int is_dir){
+
+	BlockCache* cache = &fs->cache;
+	SimpleFS_hashRemove(fs, dcb, name, block);
+	SimpleFS_dcacheSet(fs, dcb->fcb.block_in_disk, name, is_dir, -1);
+
+	// entries of the first directory block
+	int* file_blocks = dcb->file_blocks;
+	int block_entries = fs->fdb_entries;
+	int curr_block = dcb->fcb.block_in_disk;
+	int next_block = dcb->header.next_block;
+	DirectoryBlock* db = NULL;
+	
+	// the slots are scanned until the block is found, the removals leave holes in the blocks before it
+	int dim_array = 0, found = 0;
+	for(; !found; dim_array++) {
+
+		// if the array is finished reads the next directory block
+		if(dim_array >= block_entries) {
+
+			if(next_block == -1) break;
+			if(!db) db = (DirectoryBlock*) Slab_alloc(&fs->buffers);
+			if(!db || BlockCache_readBlock(cache, db, next_block) == -1) break;
+
+			file_blocks = db->file_blocks;
+			block_entries = fs->db_entries;
+			curr_block = next_block;
+			next_block = db->header.next_block;
+			dim_array = 0;
+		}
 		
-		// frees every block of the file
-		while(next_block != -1) {
-			DiskDriver_readBlock(f->sfs->disk, file, next_block);
+		if(file_blocks[dim_array] == block){
 			
-			DiskDriver_freeBlock(disk, next_block);
+			while(dim_array+1 < block_entries && file_blocks[dim_array+1]){
+				file_blocks[dim_array] = file_blocks[dim_array+1];
+				dim_array++;
+			}
+			file_blocks[dim_array] = 0;
 			
-			next_block = file->header.next_block;
+			if(db) BlockCache_writeBlock(cache, db, curr_block);
+			found = 1;
+
+			// a slot freed before the hint of the directory moves it back
+			int position = db ? db->header.block_in_file : 0;
+			if(dcb->fcb.last_block != -1 && position < dcb->fcb.last_fill) {
+				dcb->fcb.last_block = position ? curr_block : -1;
+				dcb->fcb.last_fill = position;
+			}
 		}
-		
-		DiskDriver_freeBlock(disk, f->fcb->fcb.block_in_disk);
-		DiskDriver_flush(disk);
-		free(file);
 	}
+	Slab_free(&fs->buffers, db);
 	
+	// updates dcb->num_entries in disk
+	if(found) dcb->num_entries--;
+	BlockCache_writeBlock(cache, dcb, dcb->fcb.block_in_disk);
 }
 
 
-int SimpleFS_remove_aux(DirectoryHandle* d, FileHandle* f, char* filename, int control){
-	
-	// tries to open filename
-	f = SimpleFS_openFile(d, filename);
-	
-	// tries to change directory
-	int ret = SimpleFS_changeDir(d, filename);
-	
-	// if filename is a directory
-	if(!f && ret != -1){
+// collects in the array *blocks every block of the removed file or directory starting at block
+// a directory with all its contents: the tree is visited without recursion, the directories found
+// are queued and visited in order, collecting the blocks of their files, their own blocks and their hash tables
+// the directories are then forgotten by the dentry cache
+// returns the number of blocks, -1 if the scratch memory is over
+static int SimpleFS_collectTree(SimpleFS* fs, int block, int** blocks){
+
+	BlockCache* cache = &fs->cache;
+	int num_blocks = 0, max_blocks = 256, num_dirs = 0, max_dirs = 16;
+	*blocks = (int*) Arena_alloc(&fs->scratch, max_blocks * sizeof(int));
+	int* dirs = (int*) Arena_alloc(&fs->scratch, max_dirs * sizeof(int));
+	if(!*blocks || !dirs) return -1;
+
+	// a file is collected at once
+	const FirstFileBlock* ffb = (const FirstFileBlock*) BlockCache_getBlock(cache, block);
+	if(!ffb) return -1;
+	int ret = 0;
+	if(ffb->fcb.is_dir) dirs[num_dirs++] = block;
+	else ret = SimpleFS_collectFile(fs, ffb, blocks, &num_blocks, &max_blocks);
+	BlockCache_putBlock(cache, ffb);
+
+	int i;
+	for(i = 0; i < num_dirs && ret != -1; i++) {
+
+		int dir_block = dirs[i];
+		const FirstDirectoryBlock* dir = (const FirstDirectoryBlock*) BlockCache_getBlock(cache, dirs[i]);
+		if(!dir) return -1;
+
+		ret = SimpleFS_pushBlock(fs, blocks, &num_blocks, &max_blocks, dirs[i]);
+		if(ret != -1) ret = SimpleFS_collectHash(fs, &dir->fcb, blocks, &num_blocks, &max_blocks);
+
+		// entries of the first directory block, then of the following ones
+		const void* held = dir;
+		const int* file_blocks = dir->file_blocks;
+		int block_entries = fs->fdb_entries;
+		int next_block = dir->header.next_block;
+
+		while(ret != -1) {
+
+			int j;
+			for(j = 0; j < block_entries && ret != -1; j++) {
+				if(!file_blocks[j]) continue;
+
+				ffb = (const FirstFileBlock*) BlockCache_getBlock(cache, file_blocks[j]);
+				if(!ffb) continue;
+
+				// only the first blocks of the entries of this directory, a stale slot may point to anything
+				if(ffb->header.block_in_file != 0 || ffb->fcb.directory_block != dir_block) {
+					BlockCache_putBlock(cache, ffb);
+					continue;
+				}
 
-		control++;
-		
-		int i;
-		char** names = (char**) malloc(sizeof(char*)*d->dcb->num_entries);
-		for(i = 0; i < d->dcb->num_entries; i++) {
-			names[i] = (char*) malloc(125);
-		}
-		
-		SimpleFS_readDir(names, d);
-		
-		int h = d->dcb->num_entries;
-		
-		// recursively remove the files contained in names
-		for(i = 0; i < h; i++){
-			control += SimpleFS_remove_aux(d, f, names[i], control);
+				if(ffb->fcb.is_dir) ret = SimpleFS_pushBlock(fs, &dirs, &num_dirs, &max_dirs, file_blocks[j]);
+				else ret = SimpleFS_collectFile(fs, ffb, blocks, &num_blocks, &max_blocks);
+				BlockCache_putBlock(cache, ffb);
+			}
+
+			BlockCache_putBlock(cache, held);
+			held = NULL;
+			if(next_block == -1 || ret == -1) break;
+
+			const DirectoryBlock* db = (const DirectoryBlock*) BlockCache_getBlock(cache, next_block);
+			if(!db) break;
+			ret = SimpleFS_pushBlock(fs, blocks, &num_blocks, &max_blocks, next_block);
+
+			held = db;
+			file_blocks = db->file_blocks;
+			block_entries = fs->db_entries;
+			next_block = db->header.next_block;
 		}
-		
-		free(names);
-		
-		// remove the directory once empty
-		SimpleFS_free_file_dir(d->sfs->disk, d, f, 1);
-		
-		// returns to the parent directory
-		SimpleFS_changeDir(d, "..");
-		
+		if(held) BlockCache_putBlock(cache, held);
 	}
-	// if filename is a file
-	else if(f){
-		
-		control++;
-		
-		// remove filename
-		SimpleFS_free_file_dir(f->sfs->disk, d, f, 0);	
+	if(ret == -1) return -1;
+
+	// their blocks can be reused by other directories
+	for(i = 0; i < num_dirs; i++) SimpleFS_dcacheDrop(fs, dirs[i]);
+
+	return num_blocks;
+}
+
+
+// frees the blocks of at most max removed files and directories of the reclaim queue (all of them if max <= 0)
+int SimpleFS_reclaim(SimpleFS* fs, int max){
+
+	// security check on input args
+	if(!fs) return -1;
+
+	DiskDriver* disk = fs->disk;
+	int done = 0, ret = 0;
+
+	while(disk->header->reclaim_count > 0 && (max <= 0 || done < max)) {
+
+		// an entry whose first block is free, or holds something else since, is only taken out of the queue
+		int block = disk->header->reclaim[0], stamp = disk->header->reclaim_stamp[0];
+		int owned = DiskDriver_getFreeBlock(disk, block) != block;
+		if(owned) {
+			const FirstFileBlock* ffb = (const FirstFileBlock*) BlockCache_getBlock(&fs->cache, block);
+			owned = ffb && ffb->header.block_in_file == 0 && ffb->fcb.block_in_disk == block && ffb->fcb.removed_stamp == stamp;
+			if(ffb) BlockCache_putBlock(&fs->cache, ffb);
+		}
+		if(!owned) {
+			DiskDriver_dequeueReclaim(disk);
+			continue;
+		}
+
+		ArenaMark mark = Arena_mark(&fs->scratch);
+		int* blocks;
+		int num_blocks = SimpleFS_collectTree(fs, block, &blocks);
+		if(num_blocks == -1) {
+			Arena_release(&fs->scratch, mark);
+			ret = -1;
+			break;
+		}
+
+		// the entry leaves the queue together with its blocks
+		DiskDriver_dequeueReclaim(disk);
+		if(SimpleFS_freeSorted(fs, blocks, num_blocks) == -1) ret = -1;
+		Arena_release(&fs->scratch, mark);
+		done++;
 	}
-	
-	return control;
-	
+
+	BlockCache_sync(&fs->cache);
+	return ret == -1 ? -1 : done;
 }
 
 
 // removes the file in the current directory
 // returns -1 on failure 0 on success
-// if a directory, it removes recursively all contained files
+// if a directory, it removes all contained files
 int SimpleFS_remove(DirectoryHandle* d, char* filename) {
 
 	// security check on input args
 	if(!d || !filename) return -1;
-	
-	FileHandle* f = NULL;
-		
-	// remove auxiliary function
-	int ret = SimpleFS_remove_aux(d, f, filename, 0);
-	
+
+	SimpleFS* fs = d->sfs;
+
+	// a file is removed before a directory with the same name
+	int is_dir = 0;
+	int block = SimpleFS_findEntry(fs, d->dcb, filename, 0);
+	if(block == -1) {
+		is_dir = 1;
+		block = SimpleFS_findEntry(fs, d->dcb, filename, 1);
+	}
+	if(block == -1) return -1;
+
+	// a full queue makes room freeing its oldest entry, before the entry leaves its directory
+	if(fs->disk->header->reclaim_count == DISK_RECLAIM_SLOTS && SimpleFS_reclaim(fs, 1) == -1) return -1;
+
+	// the entry leaves its directory, and its control block gets the stamp of its queue entry,
+	// on the disk before it is queued: a crash in between leaves its blocks used rather than freed under a live entry
+	int ret = 0, stamp = DiskDriver_nextReclaimStamp(fs->disk);
+	SimpleFS_removeEntry(fs, d->dcb, block, filename, is_dir);
+	FirstFileBlock* ffb = (FirstFileBlock*) BlockCache_pinBlock(&fs->cache, block);
+	if(ffb) {
+		ffb->fcb.removed_stamp = stamp;
+		ret = BlockCache_commitBlock(&fs->cache, ffb, block);
+	}
+	BlockCache_sync(&fs->cache);
+
+	// its blocks are freed by SimpleFS_reclaim, or now if it can't be queued
+	int queued = ffb && ret != -1 && DiskDriver_queueReclaim(fs->disk, block) == stamp;
+	if(!queued) {
+		ret = 0;
+		ArenaMark mark = Arena_mark(&fs->scratch);
+		int* blocks;
+		int num_blocks = SimpleFS_collectTree(fs, block, &blocks);
+		if(num_blocks == -1 || SimpleFS_freeSorted(fs, blocks, num_blocks) == -1) ret = -1;
+		Arena_release(&fs->scratch, mark);
+	}
+
+	BlockCache_sync(&fs->cache);
+	return ret;
+}
+
+
+// clears the entries from slot on of the IndexBlock table_block
+// returns 1 if the table still records some block, 0 if it can be freed
+static int SimpleFS_trimTable(SimpleFS* fs, int table_block, int slot){
+
+	IndexBlock* table = (IndexBlock*) BlockCache_pinBlock(&fs->cache, table_block);
+	if(!table) return 1;
+
+	int i, used = 0;
+	for(i = 0; i < fs->index_entries; i++) {
+		if(i >= slot) table->blocks[i] = -1;
+		if(table->blocks[i] != -1) used = 1;
+	}
+	BlockCache_commitBlock(&fs->cache, table, table_block);
+
+	return used;
+}
+
+
+// forgets the blocks after position last_index in the extents and in the index of the file f
+// the index blocks left empty are listed in blocks (at most 2 + index_entries), to be freed by the caller
+// returns their number
+static int SimpleFS_trimIndex(FileHandle* f, int last_index, int* blocks){
+
+	SimpleFS* fs = f->sfs;
+	FileControlBlock* fcb = &f->fcb->fcb;
+	int entries = fs->index_entries, num_blocks = 0;
+
+	// the extents cover the blocks from 1 in order
+	int i, first = 1;
+	for(i = 0; i < SIMPLEFS_EXTENTS && fcb->extents[i].length; i++) {
+		int length = fcb->extents[i].length;
+		if(first > last_index) {
+			fcb->extents[i].block = 0;
+			fcb->extents[i].length = 0;
+		}
+		else if(first + length - 1 > last_index) fcb->extents[i].length = last_index - first + 1;
+		first += length;
+	}
+
+	// the direct index records the blocks 1 .. entries
+	if(fcb->index_block != -1 && !SimpleFS_trimTable(fs, fcb->index_block, last_index)) {
+		blocks[num_blocks++] = fcb->index_block;
+		fcb->index_block = -1;
+	}
+
+	// each IndexBlock listed by the indirect index records entries blocks more
+	if(fcb->indirect_block == -1) return num_blocks;
+
+	IndexBlock* indirect = (IndexBlock*) BlockCache_pinBlock(&fs->cache, fcb->indirect_block);
+	if(!indirect) return num_blocks;
+
+	int used = 0;
+	for(i = 0; i < entries; i++) {
+		if(indirect->blocks[i] == -1) continue;
+
+		int first_index = 1 + entries + i * entries;
+		int slot = last_index >= first_index ? last_index - first_index + 1 : 0;
+		if(slot < entries && !SimpleFS_trimTable(fs, indirect->blocks[i], slot)) {
+			blocks[num_blocks++] = indirect->blocks[i];
+			indirect->blocks[i] = -1;
+		}
+		else used = 1;
+	}
+	BlockCache_commitBlock(&fs->cache, indirect, fcb->indirect_block);
+
+	if(!used) {
+		blocks[num_blocks++] = fcb->indirect_block;
+		fcb->indirect_block = -1;
+	}
+	return num_blocks;
+}
+
+
+// makes the file f size bytes long
+// a shorter file gives back the blocks after its new end, the index blocks not needed anymore
+// and the blocks reserved for its growth, all freed together and synchronized once
+// a longer file is filled with zeroes
+// the cursor stays where it is, unless past the new end
+// returns -1 on error
+int SimpleFS_truncate(FileHandle* f, int size){
+
+	// security check on input args
+	if(!f || size < 0) return -1;
+
+	// a removed file isn't changed anymore
+	if(!SimpleFS_isLive(f)) return -1;
+
+	SimpleFS* fs = f->sfs;
+	BlockCache* cache = &fs->cache;
+	FileControlBlock* fcb = &f->fcb->fcb;
+
+	int pos_in_file = f->pos_in_file, cursor_block = f->cursor_block;
+	int cursor_index = f->cursor_index, pos_in_block = f->pos_in_block;
+
+	// the file grows by writing zeroes at its end
+	if(size > fcb->size_in_bytes) {
+		char* zeroes = (char*) Slab_alloc(&fs->buffers);
+		if(!zeroes) return -1;
+		memset(zeroes, 0, fs->block_size);
+
+		SimpleFS_cursorToEnd(f);
+		int flags = f->flags, ret = 0;
+		f->flags = 0;
+		while(fcb->size_in_bytes < size && ret != -1) {
+			int len = size - fcb->size_in_bytes < fs->block_size ? size - fcb->size_in_bytes : fs->block_size;
+			if(SimpleFS_write(f, zeroes, len) != len) ret = -1;
+		}
+		f->flags = flags;
+		Slab_free(&fs->buffers, zeroes);
+
+		SimpleFS_moveCursor(f, pos_in_file);
+		return ret;
+	}
+
+	// the block holding the new end of the file
+	if(SimpleFS_moveCursor(f, size) == -1) return -1;
+	int last_block = f->cursor_block, last_index = f->cursor_index, last_fill = f->pos_in_block;
+
+	// the blocks to free: index blocks, preallocation window and the rest of the chain
+	ArenaMark mark = Arena_mark(&fs->scratch);
+	int max_blocks = 2 + fs->index_entries + fcb->prealloc_blocks + 64;
+	int* blocks = (int*) Arena_alloc(&fs->scratch, max_blocks * sizeof(int));
+	if(!blocks) return -1;
+
+	int i, num_blocks = SimpleFS_trimIndex(f, last_index, blocks);
+	for(i = 0; i < fcb->prealloc_blocks; i++) blocks[num_blocks++] = fcb->prealloc_block + i;
+	fcb->prealloc_block = -1;
+	fcb->prealloc_blocks = 0;
+
+	// the chain is cut after the new last block, the first one is the copy in the handle
+	int next_block;
+	if(last_index == 0) {
+		next_block = f->fcb->header.next_block;
+		f->fcb->header.next_block = -1;
+	}
+	else {
+		BlockHeader* header = (BlockHeader*) BlockCache_pinBlock(cache, last_block);
+		if(!header) {
+			Arena_release(&fs->scratch, mark);
+			return -1;
+		}
+		next_block = header->next_block;
+		header->next_block = -1;
+		BlockCache_commitBlock(cache, header, last_block);
+	}
+
+	int ret = SimpleFS_collectChain(fs, next_block, &blocks, &num_blocks, &max_blocks);
+	if(SimpleFS_freeSorted(fs, blocks, num_blocks) == -1) ret = -1;
+	Arena_release(&fs->scratch, mark);
+
+	fcb->size_in_bytes = size;
+	fcb->size_in_blocks = size ? last_index + 1 : 0;
+	fcb->last_block = last_block;
+	fcb->last_fill = last_fill;
+
+	// a cursor before the new end is still in a block of the file
+	if(pos_in_file <= size) {
+		f->pos_in_file = pos_in_file;
+		f->cursor_block = cursor_block;
+		f->cursor_index = cursor_index;
+		f->pos_in_block = pos_in_block;
+	}
+
+	BlockCache_writeBlock(cache, f->fcb, fcb->block_in_disk);
+	BlockCache_sync(cache);
+	return ret;
+}
+
+
+// reserves the blocks for the file f to grow up to size bytes, in one run of contiguous blocks
+// the run becomes the preallocation window of the file, taken by the following writes
+// returns the number of blocks reserved for the growth of the file, -1 if the disk has no run long enough
+int SimpleFS_fallocate(FileHandle* f, int size){
+
+	// security check on input args
+	if(!f || size < 0) return -1;
+
+	// a removed file isn't changed anymore
+	if(!SimpleFS_isLive(f)) return -1;
+
+	SimpleFS* fs = f->sfs;
+	DiskDriver* disk = fs->disk;
+	FileControlBlock* fcb = &f->fcb->fcb;
+
+	// blocks of the file once size bytes long, beyond the ones it has and the ones already reserved
+	int blocks = 1;
+	if(size > fs->ffb_data_size) blocks += (size - fs->ffb_data_size + fs->fb_data_size - 1) / fs->fb_data_size;
+	int needed = blocks - (fcb->size_in_blocks ? fcb->size_in_blocks : 1);
+	if(needed <= fcb->prealloc_blocks) return fcb->prealloc_blocks;
+
+	// the window grows in place if the blocks after it are free
+	int end = fcb->prealloc_block + fcb->prealloc_blocks;
+	if(fcb->prealloc_blocks && DiskDriver_getFreeLength(disk, end, needed - fcb->prealloc_blocks) == needed - fcb->prealloc_blocks) {
+		if(DiskDriver_reserveBlocks(disk, end, needed - fcb->prealloc_blocks) == -1) return -1;
+		fcb->prealloc_blocks = needed;
+	}
+	else {
+		// otherwise it is replaced by a run right after the end of the file, or the first one long enough
+		SimpleFS_ensureFree(fs, needed);
+		int goal = fcb->last_block + 1;
+		int start = DiskDriver_getFreeLength(disk, goal, needed) == needed ? goal : DiskDriver_getFreeRun(disk, goal, needed);
+		if(start == -1) start = DiskDriver_getFreeRun(disk, 0, needed);
+		if(start == -1) return -1;
+
+		SimpleFS_freePrealloc(fs, fcb);
+		if(DiskDriver_reserveBlocks(disk, start, needed) != -1) {
+			fcb->prealloc_block = start;
+			fcb->prealloc_blocks = needed;
+		}
+	}
+
+	BlockCache_writeBlock(&fs->cache, f->fcb, fcb->block_in_disk);
+	BlockCache_sync(&fs->cache);
+	return fcb->prealloc_blocks == needed ? needed : -1;
+}
+
+
+/******************* path based operations *******************/
+
+// looks in the directory dir_block for the entry called name, a file (is_dir = 0) or a directory (is_dir = 1)
+// "." and ".." are the directory itself and its parent (the root is its own parent)
+// returns the first block of the entry, -1 if not found
+static int SimpleFS_lookup(SimpleFS* fs, int dir_block, const char* name, int is_dir){
+
+	if(is_dir && (name[0] == '\0' || strcmp(name, ".") == 0)) return dir_block;
+
+	const FirstDirectoryBlock* dcb = (const FirstDirectoryBlock*) BlockCache_getBlock(&fs->cache, dir_block);
+	if(!dcb) return -1;
+
+	int found;
+	if(strcmp(name, "..") == 0) found = is_dir ? (dcb->fcb.directory_block != -1 ? dcb->fcb.directory_block : dir_block) : -1;
+	else found = SimpleFS_findEntry(fs, dcb, name, is_dir);
+
+	BlockCache_putBlock(&fs->cache, dcb);
+	return found;
+}
+
+
+// walks path from the directory d, or from the root if path starts with '/', up to its last component
+// the components are separated by '/', every one before the last one must be a directory
+// the handle d is not changed
+// returns the first block of the directory containing the last component, copied in last
+// ("" if path has only slashes or is empty), -1 if a directory along the path doesn't exist
+static int SimpleFS_resolve(DirectoryHandle* d, const char* path, char* last){
+
+	SimpleFS* fs = d->sfs;
+
+	// the root directory is in the first block
+	int dir_block = path[0] == '/' ? 0 : d->dcb->fcb.block_in_disk;
+
+	char name[128];
+	while(1) {
+
+		// copies the next component
+		while(*path == '/') path++;
+		int len = strcspn(path, "/");
+		if(len >= (int) sizeof(name)) return -1;
+		memcpy(name, path, len);
+		name[len] = '\0';
+		path += len;
+
+		// the last one is left to the caller
+		while(*path == '/') path++;
+		if(*path == '\0') break;
+
+		dir_block = SimpleFS_lookup(fs, dir_block, name, 1);
+		if(dir_block == -1) return -1;
+	}
+
+	strcpy(last, name);
+	return dir_block;
+}
+
+
+// returns a handle on the directory dir_block, with its own copies of the directory and of its parent
+// NULL if they can't be read, the handle is freed by SimpleFS_closeDir
+static DirectoryHandle* SimpleFS_dirHandle(SimpleFS* fs, int dir_block){
+
+	DirectoryHandle* handle = (DirectoryHandle*) Slab_alloc(&fs->dir_handles);
+	if(!handle) return NULL;
+	handle->sfs = fs;
+	handle->dcb = (FirstDirectoryBlock*) Slab_alloc(&fs->buffers);
+	handle->directory = NULL;
+	if(!handle->dcb || BlockCache_readBlock(&fs->cache, handle->dcb, dir_block) == -1) {
+		SimpleFS_closeDir(handle);
+		return NULL;
+	}
+
+	if(handle->dcb->fcb.directory_block != -1) {
+		handle->directory = (FirstDirectoryBlock*) Slab_alloc(&fs->buffers);
+		if(!handle->directory || BlockCache_readBlock(&fs->cache, handle->directory, handle->dcb->fcb.directory_block) == -1) {
+			SimpleFS_closeDir(handle);
+			return NULL;
+		}
+	}
+
+	SimpleFS_rewindDir(handle);
+	return handle;
+}
+
+
+// reloads the copies of the directories kept by d, after they have been changed through another handle
+static void SimpleFS_reloadHandle(DirectoryHandle* d){
+
+	BlockCache_readBlock(&d->sfs->cache, d->dcb, d->dcb->fcb.block_in_disk);
+	if(d->directory) BlockCache_readBlock(&d->sfs->cache, d->directory, d->directory->fcb.block_in_disk);
+}
+
+
+// opens the file at path
+FileHandle* SimpleFS_openPath(DirectoryHandle* d, const char* path){
+
+	// security check on input args
+	if(!d || !path) return NULL;
+
+	char name[128];
+	int dir_block = SimpleFS_resolve(d, path, name);
+	if(dir_block == -1) return NULL;
+
+	int block = SimpleFS_lookup(d->sfs, dir_block, name, 0);
+	if(block == -1) return NULL;
+
+	return SimpleFS_openBlock(d->sfs, block, NULL);
+}
+
+
+// creates an empty file at path
+FileHandle* SimpleFS_createPath(DirectoryHandle* d, const char* path){
+
+	// security check on input args
+	if(!d || !path) return NULL;
+
+	char name[128];
+	int dir_block = SimpleFS_resolve(d, path, name);
+	if(dir_block == -1 || name[0] == '\0' || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) return NULL;
+
+	// the directory of d is changed through d itself, the others through a handle of their own
+	if(dir_block == d->dcb->fcb.block_in_disk) {
+		FileHandle* f = SimpleFS_createFile(d, name);
+		if(f) f->directory = NULL;
+		return f;
+	}
+
+	DirectoryHandle* parent = SimpleFS_dirHandle(d->sfs, dir_block);
+	FileHandle* f = SimpleFS_createFile(parent, name);
+	if(f) f->directory = NULL;
+	SimpleFS_closeDir(parent);
+
+	SimpleFS_reloadHandle(d);
+	return f;
+}
+
+
+// creates a directory at path
+int SimpleFS_mkDirPath(DirectoryHandle* d, const char* path){
+
+	// security check on input args
+	if(!d || !path) return -1;
+
+	char name[128];
+	int dir_block = SimpleFS_resolve(d, path, name);
+	if(dir_block == -1 || name[0] == '\0' || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) return -1;
+
+	if(dir_block == d->dcb->fcb.block_in_disk) return SimpleFS_mkDir(d, name);
+
+	DirectoryHandle* parent = SimpleFS_dirHandle(d->sfs, dir_block);
+	int ret = SimpleFS_mkDir(parent, name);
+	SimpleFS_closeDir(parent);
+
+	SimpleFS_reloadHandle(d);
+	return ret;
+}
+
+
+// removes the file or directory at path
+int SimpleFS_removePath(DirectoryHandle* d, const char* path){
+
+	// security check on input args
+	if(!d || !path) return -1;
+
+	char name[128];
+	int dir_block = SimpleFS_resolve(d, path, name);
+	if(dir_block == -1 || name[0] == '\0' || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) return -1;
+
+	// the directory of d and its ancestors stay
+	int target = SimpleFS_lookup(d->sfs, dir_block, name, 1);
+	if(target != -1) {
+		int block = d->dcb->fcb.block_in_disk;
+		while(block != -1 && block != target) {
+			const FirstDirectoryBlock* dcb = (const FirstDirectoryBlock*) BlockCache_getBlock(&d->sfs->cache, block);
+			if(!dcb) return -1;
+			block = dcb->fcb.directory_block;
+			BlockCache_putBlock(&d->sfs->cache, dcb);
+		}
+		if(block == target) return -1;
+	}
+
+	if(dir_block == d->dcb->fcb.block_in_disk) return SimpleFS_remove(d, name);
+
+	DirectoryHandle* parent = SimpleFS_dirHandle(d->sfs, dir_block);
+	int ret = SimpleFS_remove(parent, name);
+	SimpleFS_closeDir(parent);
+
+	SimpleFS_reloadHandle(d);
+	return ret;
+}
+
+
+// copies in fcb the control block of the file or directory at path
+int SimpleFS_stat(DirectoryHandle* d, const char* path, FileControlBlock* fcb){
+
+	// security check on input args
+	if(!d || !path || !fcb) return -1;
+
+	char name[128];
+	int dir_block = SimpleFS_resolve(d, path, name);
+	if(dir_block == -1) return -1;
+
+	// a file, or else a directory
+	int block = SimpleFS_lookup(d->sfs, dir_block, name, 0);
+	if(block == -1) block = SimpleFS_lookup(d->sfs, dir_block, name, 1);
+	if(block == -1) return -1;
+
+	const FirstFileBlock* ffb = (const FirstFileBlock*) BlockCache_getBlock(&d->sfs->cache, block);
+	if(!ffb) return -1;
+	*fcb = ffb->fcb;
+	BlockCache_putBlock(&d->sfs->cache, ffb);
+
+	return 0;
+}
+
+
+/******************* images of the first layout *******************/
+
+// the first layout had a header of three ints, a bitmap of one byte per block and blocks of 512 bytes,
+// the control blocks ended at is_dir and the arrays of the blocks were sized on that
+#define SIMPLEFS_LEGACY_BLOCK_SIZE 512
+#define SIMPLEFS_LEGACY_HEADER_SIZE (3 * (long) sizeof(int))
+
+typedef struct {
+  int directory_block;
+  int block_in_disk;
+  char name[128];
+  int size_in_bytes;
+  int size_in_blocks;
+  int is_dir;
+} LegacyFileControlBlock;
+
+typedef struct {
+  BlockHeader header;
+  LegacyFileControlBlock fcb;
+  char data[SIMPLEFS_LEGACY_BLOCK_SIZE - sizeof(LegacyFileControlBlock) - sizeof(BlockHeader)];
+} LegacyFirstFileBlock;
+
+typedef struct {
+  BlockHeader header;
+  char data[SIMPLEFS_LEGACY_BLOCK_SIZE - sizeof(BlockHeader)];
+} LegacyFileBlock;
+
+typedef struct {
+  BlockHeader header;
+  LegacyFileControlBlock fcb;
+  int num_entries;
+  int file_blocks[(SIMPLEFS_LEGACY_BLOCK_SIZE - sizeof(BlockHeader) - sizeof(LegacyFileControlBlock) - sizeof(int)) / sizeof(int)];
+} LegacyFirstDirectoryBlock;
+
+typedef struct {
+  BlockHeader header;
+  int file_blocks[(SIMPLEFS_LEGACY_BLOCK_SIZE - sizeof(BlockHeader)) / sizeof(int)];
+} LegacyDirectoryBlock;
+
+// the directories still to be copied, with the block in the old image and the path in the new one
+typedef struct {
+  int block;
+  char* path;
+} LegacyDir;
+
+// reads block of the old image in buf, -1 if it is out of the image
+static int SimpleFS_legacyRead(int fd, int num_blocks, int block, void* buf){
+
+	if(block < 0 || block >= num_blocks) return -1;
+	off_t offset = SIMPLEFS_LEGACY_HEADER_SIZE + num_blocks + (off_t) block * SIMPLEFS_LEGACY_BLOCK_SIZE;
+	return pread(fd, buf, SIMPLEFS_LEGACY_BLOCK_SIZE, offset) == SIMPLEFS_LEGACY_BLOCK_SIZE ? 0 : -1;
+}
+
+// number of blocks of filename if it is an image of the first layout, -1 otherwise
+static int SimpleFS_legacyBlocks(int fd){
+
+	int header[3];
+	struct stat st;
+	if(pread(fd, header, sizeof(header), 0) != sizeof(header) || fstat(fd, &st) == -1) return -1;
+
+	int num_blocks = header[0], free_blocks = header[1], first_free_block = header[2];
+	if(num_blocks <= 0 || free_blocks < 0 || free_blocks > num_blocks) return -1;
+	if(first_free_block < -1 || first_free_block >= num_blocks) return -1;
+	if(st.st_size != SIMPLEFS_LEGACY_HEADER_SIZE + num_blocks + (off_t) num_blocks * SIMPLEFS_LEGACY_BLOCK_SIZE) return -1;
+
+	// the root is always in use
+	char root_used;
+	if(pread(fd, &root_used, 1, SIMPLEFS_LEGACY_HEADER_SIZE) != 1 || !root_used) return -1;
+	return num_blocks;
+}
+
+// copies in f the content of the old file starting with ffb, -1 if its chain is broken
+static int SimpleFS_legacyCopyFile(int fd, int num_blocks, const LegacyFirstFileBlock* ffb, FileHandle* f){
+
+	int remaining = ffb->fcb.size_in_bytes;
+	int size = remaining < (int) sizeof(ffb->data) ? remaining : (int) sizeof(ffb->data);
+	if(size > 0 && SimpleFS_write(f, (void*) ffb->data, size) != size) return -1;
+	remaining -= size;
+
+	// the chain can't be longer than the image
+	LegacyFileBlock fb;
+	int next = ffb->header.next_block;
+	for(int steps = 0; remaining > 0 && next != -1 && steps < num_blocks; steps++) {
+		if(SimpleFS_legacyRead(fd, num_blocks, next, &fb) == -1) return -1;
+		size = remaining < (int) sizeof(fb.data) ? remaining : (int) sizeof(fb.data);
+		if(SimpleFS_write(f, fb.data, size) != size) return -1;
+		remaining -= size;
+		next = fb.header.next_block;
+	}
+	return remaining > 0 ? -1 : 0;
+}
+
+// copies in the new file system the entry in block of the old directory dir_block, whose path is dir_path
+// directories are appended to dirs, returns the number of entries copied (0 or 1), -1 on error
+static int SimpleFS_legacyCopyEntry(int fd, int num_blocks, DirectoryHandle* root, int dir_block, const char* dir_path,
+                                    int block, LegacyDir** dirs, int* num_dirs){
+
+	LegacyFirstFileBlock ffb;
+	if(SimpleFS_legacyRead(fd, num_blocks, block, &ffb) == -1) return 0;
+
+	// stale slots, and names that can't be a component of a path, are left behind
+	ffb.fcb.name[sizeof(ffb.fcb.name) - 1] = '\0';
+	if(ffb.header.block_in_file != 0 || ffb.fcb.block_in_disk != block || ffb.fcb.directory_block != dir_block) return 0;
+	if(ffb.fcb.name[0] == '\0' || strchr(ffb.fcb.name, '/') || strcmp(ffb.fcb.name, ".") == 0 || strcmp(ffb.fcb.name, "..") == 0) return 0;
+
+	char* path = (char*) malloc(strlen(dir_path) + strlen(ffb.fcb.name) + 2);
+	if(!path) return -1;
+	sprintf(path, "%s/%s", dir_path, ffb.fcb.name);
+
+	if(ffb.fcb.is_dir) {
+		// a directory appears only once in the tree, a loop would be longer than the image
+		LegacyDir* grown = *num_dirs < num_blocks ? (LegacyDir*) realloc(*dirs, (*num_dirs + 1) * sizeof(LegacyDir)) : NULL;
+		if(!grown || SimpleFS_mkDirPath(root, path) == -1) {
+			free(path);
+			return -1;
+		}
+		*dirs = grown;
+		(*dirs)[*num_dirs].block = block;
+		(*dirs)[(*num_dirs)++].path = path;
+		return 1;
+	}
+
+	FileHandle* f = SimpleFS_createPath(root, path);
+	free(path);
+	if(!f) return -1;
+	int ret = SimpleFS_legacyCopyFile(fd, num_blocks, &ffb, f);
 	SimpleFS_close(f);
-	
-	if(ret)	return 0;
-	return -1;
+	return ret == -1 ? -1 : 1;
+}
+
+// converts filename, an image of the first layout, to the current one
+// the files and directories are copied in a new image that replaces filename once complete,
+// with a quarter more blocks as the control blocks and the hash tables take more room
+// returns the number of files and directories copied, -1 if filename isn't such an image or the copy fails
+int SimpleFS_migrate(const char* filename){
+
+	// security check on input args
+	if(!filename) return -1;
+
+	int fd = open(filename, O_RDONLY);
+	if(fd == -1) return -1;
+	int num_blocks = SimpleFS_legacyBlocks(fd);
+	if(num_blocks == -1) {
+		close(fd);
+		return -1;
+	}
+
+	char* tmp_name = (char*) malloc(strlen(filename) + sizeof(".migrate"));
+	sprintf(tmp_name, "%s.migrate", filename);
+
+	DiskDriver* disk = (DiskDriver*) malloc(sizeof(DiskDriver));
+	DiskDriver_format(disk, tmp_name, num_blocks + num_blocks / 4, DISK_DEFAULT_BLOCK_SIZE, DISK_BACKEND_MMAP);
+	if(!disk->header) {
+		free(disk);
+		free(tmp_name);
+		close(fd);
+		return -1;
+	}
+	SimpleFS fs;
+	DirectoryHandle* root = SimpleFS_init(&fs, disk);
+
+	// breadth first from the root, at block 0 in the first layout
+	LegacyDir* dirs = (LegacyDir*) malloc(sizeof(LegacyDir));
+	int num_dirs = 1, copied = root ? 0 : -1;
+	dirs[0].block = 0;
+	dirs[0].path = strdup("");
+
+	for(int i = 0; i < num_dirs && copied != -1; i++) {
+		LegacyFirstDirectoryBlock fdb;
+		if(SimpleFS_legacyRead(fd, num_blocks, dirs[i].block, &fdb) == -1) {
+			copied = -1;
+			break;
+		}
+
+		// the slots of the first block, then those of the chain, the empty ones are 0
+		int* slots = fdb.file_blocks;
+		int num_slots = sizeof(fdb.file_blocks) / sizeof(int);
+		int next = fdb.header.next_block;
+		LegacyDirectoryBlock db;
+		for(int steps = 0; copied != -1 && steps < num_blocks; steps++) {
+			for(int j = 0; j < num_slots && copied != -1; j++) {
+				if(slots[j] <= 0) continue;
+				int ret = SimpleFS_legacyCopyEntry(fd, num_blocks, root, dirs[i].block, dirs[i].path, slots[j], &dirs, &num_dirs);
+				copied = ret == -1 ? -1 : copied + ret;
+			}
+			if(next == -1 || SimpleFS_legacyRead(fd, num_blocks, next, &db) == -1) break;
+			slots = db.file_blocks;
+			num_slots = sizeof(db.file_blocks) / sizeof(int);
+			next = db.header.next_block;
+		}
+	}
+
+	for(int i = 0; i < num_dirs; i++) free(dirs[i].path);
+	free(dirs);
+	close(fd);
+
+	if(root) {
+		SimpleFS_closeDir(root);
+		SimpleFS_destroy(&fs);
+	}
+	DiskDriver_destroy(disk);
+
+	// filename is replaced only by a complete copy
+	if(copied == -1 || rename(tmp_name, filename) == -1) {
+		unlink(tmp_name);
+		copied = -1;
+	}
+	free(tmp_name);
+	return copied;
 }
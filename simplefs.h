@@ -1,8 +1,15 @@
 #pragma once
-#include "disk_driver.h"
+#include "block_cache.h"
+#include "arena.h"
 
 /*these are structures stored on disk*/
 
+// runs of contiguous blocks recorded in the FileControlBlock
+#define SIMPLEFS_EXTENTS 4
+
+// most blocks reserved at once for a growing file
+#define SIMPLEFS_PREALLOC_MAX 256
+
 // header, occupies the first portion of each block in the disk
 // represents a chained list of blocks
 typedef struct {
@@ -12,6 +19,12 @@ typedef struct {
 } BlockHeader;
 
 
+// a run of contiguous blocks of a file
+typedef struct {
+  int block;           // first block of the run on the disk
+  int length;          // number of blocks, 0 if unused
+} Extent;
+
 // this is in the first block of a chain, after the header
 typedef struct {
   int directory_block; // first block of the parent directory
@@ -20,24 +33,35 @@ typedef struct {
   int  size_in_bytes;
   int size_in_blocks;
   int is_dir;          // 0 for file, 1 for dir
+  int index_block;     // IndexBlock of the blocks 1 .. SimpleFS.index_entries of the file, -1 if none
+                       // for a directory, IndexBlock of the buckets of its hash table
+  int indirect_block;  // IndexBlock of the IndexBlocks of the following blocks, -1 if none
+  Extent extents[SIMPLEFS_EXTENTS]; // blocks 1, 2, ... of the file in runs, the blocks after them are in the index
+  int prealloc_block;  // first block reserved for the growth of the file and not used yet, -1 if none
+  int prealloc_blocks; // number of blocks reserved from prealloc_block
+  int last_block;      // block holding the end of the file, the end of the file is reached without following the chain
+                       // for a directory, first DirectoryBlock that can have a free slot, -1 for its first block
+  int last_fill;       // bytes of data in last_block, for a directory the position of last_block in its chain
+  int removed_stamp;   // stamp of its entry in the reclaim queue of the disk once removed, 0 before
 } FileControlBlock;
 
 // this is the first physical block of a file
 // it has a header
 // an FCB storing file infos
 // and can contain some data
+// the arrays fill the rest of the block, their sizes depend on the block size of the disk
 
 /******************* stuff on disk BEGIN *******************/
 typedef struct {
   BlockHeader header;
   FileControlBlock fcb;
-  char data[BLOCK_SIZE-sizeof(FileControlBlock) - sizeof(BlockHeader)] ;
+  char data[];         // SimpleFS.ffb_data_size bytes
 } FirstFileBlock;
 
 // this is one of the next physical blocks of a file
 typedef struct {
   BlockHeader header;
-  char  data[BLOCK_SIZE-sizeof(BlockHeader)];
+  char  data[];        // SimpleFS.fb_data_size bytes
 } FileBlock;
 
 // this is the first physical block of a directory
@@ -45,33 +69,105 @@ typedef struct {
   BlockHeader header;
   FileControlBlock fcb;
   int num_entries;
-  int file_blocks[ (BLOCK_SIZE
-		   -sizeof(BlockHeader)
-		   -sizeof(FileControlBlock)
-		    -sizeof(int))/sizeof(int) ];
+  int file_blocks[];   // SimpleFS.fdb_entries entries
 } FirstDirectoryBlock;
 
 // this is remainder block of a directory
 typedef struct {
   BlockHeader header;
-  int file_blocks[ (BLOCK_SIZE-sizeof(BlockHeader))/sizeof(int) ];
+  int file_blocks[];   // SimpleFS.db_entries entries
 } DirectoryBlock;
+
+// table of the blocks of a file by position in the file, to reach them without following the chain
+// the chain stays linked, files without an index are followed through it
+typedef struct {
+  BlockHeader header;  // not chained, block_in_file is -1
+  int blocks[];        // SimpleFS.index_entries entries, -1 if not recorded
+} IndexBlock;
+// an entry of the hash table of a directory
+typedef struct {
+  unsigned int hash;   // hash of the name of the entry
+  int block;           // first block of the entry
+} DirEntry;
+
+// a block of a bucket of the hash table of a directory
+// the buckets are listed in the IndexBlock of the directory by hash, and chained when full
+typedef struct {
+  BlockHeader header;  // chained list of the blocks of the bucket, block_in_file is -1
+  int num_entries;
+  DirEntry entries[];  // SimpleFS.bucket_entries entries
+} HashBlock;
 /******************* stuff on disk END *******************/
   
   
   
+// entries of the dentry cache, and buckets of its hash table
+#define SIMPLEFS_DCACHE_SIZE 256
+#define SIMPLEFS_DCACHE_BUCKETS 512
+
+// buffers and handles allocated together when their slab is empty, and bytes of the scratch arena
+#define SIMPLEFS_SLAB_BUFFERS 8
+#define SIMPLEFS_SLAB_HANDLES 32
+#define SIMPLEFS_SCRATCH_SIZE 4096
+
+// records read at a time by SimpleFS_readDir
+#define SIMPLEFS_READDIR_PAGE 16
+
+// flags of SimpleFS_openFileFlags
+#define SIMPLEFS_APPEND 1    // every write goes at the end of the file, wherever the cursor is
+
+// a name looked up in a directory, positive or negative
+typedef struct {
+  int dir_block;       // first block of the directory, -1 if the entry is unused
+  int is_dir;          // the name was looked up as a directory (1) or as a file (0)
+  int block;           // first block of the entry, -1 if the directory has no such entry
+  unsigned int hash;   // hash of the name
+  int next_hash;       // next entry of the same bucket, -1 if last
+  int prev_lru;        // more recently used entry, -1 if first
+  int next_lru;        // less recently used entry, -1 if last
+  char name[128];
+} Dentry;
+
+// LRU cache of the lookups of names in the directories, in memory only
+typedef struct {
+  Dentry entries[SIMPLEFS_DCACHE_SIZE];
+  int buckets[SIMPLEFS_DCACHE_BUCKETS]; // first entry of each bucket, -1 if empty
+  int lru_first;       // most recently used entry
+  int lru_last;        // least recently used entry, reused first
+  int hits;
+  int misses;
+} DentryCache;
+
 typedef struct {
   DiskDriver* disk;
-  // add more fields if needed
+  BlockCache cache;    // every block of the file system is read and written through it
+  // sizes of the blocks content, set by SimpleFS_init from the block size of the disk
+  int block_size;
+  int ffb_data_size;   // bytes of FirstFileBlock.data
+  int fb_data_size;    // bytes of FileBlock.data
+  int fdb_entries;     // entries of FirstDirectoryBlock.file_blocks
+  int db_entries;      // entries of DirectoryBlock.file_blocks
+  int index_entries;   // entries of IndexBlock.blocks
+  int bucket_entries;  // entries of HashBlock.entries
+  DentryCache dcache;  // names looked up, kept up to date by the operations changing the directories
+  // memory of the handles and of the copies of the blocks, freed all together by SimpleFS_destroy
+  Slab buffers;        // buffers of block_size bytes
+  Slab file_handles;
+  Slab dir_handles;
+  Arena scratch;       // memory used during an operation, released when it ends
 } SimpleFS;
 
 // this is a file handle, used to refer to open files
 typedef struct {
   SimpleFS* sfs;                   // pointer to memory file system structure
   FirstFileBlock* fcb;             // pointer to the first block of the file(read it)
-  FirstDirectoryBlock* directory;  // pointer to the directory where the file is stored
+  FirstDirectoryBlock* directory;  // pointer to the directory where the file is stored (NULL if opened by path)
   BlockHeader* current_block;      // current block in the file
   int pos_in_file;                 // position of the cursor
+  int cursor_block;                // block of the disk containing the cursor
+  int cursor_index;                // position of that block in the file (0 for the first file block)
+  int pos_in_block;                // offset of the cursor in that block
+  int flags;                       // SIMPLEFS_APPEND or 0
 } FileHandle;
 
 typedef struct {
@@ -79,17 +175,36 @@ typedef struct {
   FirstDirectoryBlock* dcb;        // pointer to the first block of the directory(read it)
   FirstDirectoryBlock* directory;  // pointer to the parent directory (null if top level)
   BlockHeader* current_block;      // current block in the directory
-  int pos_in_dir;                  // absolute position of the cursor in the directory
+  int pos_in_dir;                  // absolute position of the cursor in the directory (entries read by SimpleFS_readDirRecords)
   int pos_in_block;                // relative position of the cursor in the block
+  int cursor_block;                // block of the disk containing the cursor, -1 past the last one
 } DirectoryHandle;
 
+// an entry of a directory, as listed by SimpleFS_readDirRecords
+typedef struct {
+  char name[128];
+  int block;                       // first block of the entry
+  int size_in_bytes;
+  int is_dir;
+} DirRecord;
+
 // initializes a file system on an already made disk
 // returns a handle to the top level directory stored in the first block
 DirectoryHandle* SimpleFS_init(SimpleFS* fs, DiskDriver* disk);
 
+// sets the number of blocks kept in the block cache of fs (BLOCK_CACHE_DEFAULT_FRAMES after SimpleFS_init)
+// 0 disables the cache
+// returns -1 on error
+int SimpleFS_setCacheSize(SimpleFS* fs, int num_frames);
+
+// writes back the blocks changed in the cache and frees the resources of fs
+// the handles still open are freed too
+// the disk is left open
+void SimpleFS_destroy(SimpleFS* fs);
+
 // creates the inital structures, the top level directory
 // has name "/" and its control block is in the first position
-// it also clears the bitmap of occupied blocks on the disk
+// it also clears the bitmap of occupied blocks on the disk and the queue of the removed files
 // the current_directory_block is cached in the SimpleFS struct
 // and set to the top level directory
 void SimpleFS_format(SimpleFS* fs);
@@ -102,23 +217,42 @@ FileHandle* SimpleFS_createFile(DirectoryHandle* d, const char* filename);
 // reads in the (preallocated) blocks array, the name of all files in a directory 
 int SimpleFS_readDir(char** names, DirectoryHandle* d);
 
+// fills records with the next entries of the directory d, at most max, from the cursor of d
+// the cursor moves past them, so that a directory of any size is listed a page at a time
+// entries added or removed between the calls may be missed
+// returns the number of records filled (0 once the whole directory is read), -1 on error
+int SimpleFS_readDirRecords(DirectoryHandle* d, DirRecord* records, int max);
+
+// moves the cursor of d back to the first entry of the directory
+void SimpleFS_rewindDir(DirectoryHandle* d);
+
 // opens a file in the  directory d. The file should be exisiting
 FileHandle* SimpleFS_openFile(DirectoryHandle* d, const char* filename);
 
+// opens a file in the directory d as SimpleFS_openFile, with flags (SIMPLEFS_APPEND)
+// in append mode the writes start from the end of the file, reached at once through its control block
+FileHandle* SimpleFS_openFileFlags(DirectoryHandle* d, const char* filename, int flags);
+
 // closes a file handle (destroyes it)
+// the blocks reserved for the growth of the file and not written are freed
+// returns -1 if they can't be freed
 int SimpleFS_close(FileHandle* f);
 
+// closes a directory handle, as the one returned by SimpleFS_init (destroyes it)
+int SimpleFS_closeDir(DirectoryHandle* d);
+
 // writes in the file, at current position for size bytes stored in data
 // overwriting and allocating new space if necessary
-// returns the number of bytes written
+// returns the number of bytes written, -1 if the file was removed while f was open
 int SimpleFS_write(FileHandle* f, void* data, int size);
 
-// writes in the file, at current position size bytes stored in data
-// overwriting and allocating new space if necessary
-// returns the number of bytes read
+// reads in the file, at current position size bytes stored in data
+// the bytes are copied as they are, data is not terminated
+// returns the number of bytes read (less than size at the end of the file) and moves the cursor after them
 int SimpleFS_read(FileHandle* f, void* data, int size);
 
 // returns the number of bytes read (moving the current pointer to pos)
+// the cursor moves from where it is, forward or backward, only across the blocks in between
 // returns pos on success
 // -1 on error (file too short)
 int SimpleFS_seek(FileHandle* f, int pos);
@@ -135,9 +269,62 @@ int SimpleFS_mkDir(DirectoryHandle* d, char* dirname);
 
 // removes the file in the current directory
 // returns -1 on failure 0 on success
-// if a directory, it removes recursively all contained files
+// if a directory, it removes all contained files and directories
+// a file is removed before a directory with the same name
+// the entry leaves the directory at once, in a time independent of the size of what it removes:
+// its first block goes in the reclaim queue of the disk header, and its blocks stay used until SimpleFS_reclaim
+// the directory change and the stamp of the removed control block reach the disk before the queue entry,
+// the blocks are freed at once if it can't be queued
 int SimpleFS_remove(DirectoryHandle* d, char* filename);
 
+// frees the blocks of at most max files and directories of the reclaim queue, oldest first (all of them if max <= 0)
+// a directory is freed with its whole tree, visited once, and the blocks of each entry are freed together
+// it is called when idle, or when the disk is full or the queue is
+// the queue is in the disk header, the removals not yet reclaimed are found again after a crash
+// an entry is freed only if its first block still holds the removed file, with the stamp of the entry
+// returns the number of entries reclaimed, -1 on error
+int SimpleFS_reclaim(SimpleFS* fs, int max);
 
-  
+// makes the file size bytes long, cutting its end or filling it with zeroes
+// the blocks past the new end are freed together, with the ones reserved for its growth
+// the cursor is kept if still in the file, otherwise it is at the new end
+// returns 0 on success, -1 on error or if the file was removed while f was open
+int SimpleFS_truncate(FileHandle* f, int size);
+
+// reserves in one contiguous run the blocks the file needs to grow up to size bytes
+// its size doesn't change, the following writes take the reserved blocks in order
+// the blocks still reserved when the file is closed are freed
+// returns the number of blocks reserved for the file, -1 if there is no free run long enough or the file was removed
+int SimpleFS_fallocate(FileHandle* f, int size);
+
+// path based operations
+// a path starting with '/' is absolute, otherwise it is relative to the directory of d
+// its components are separated by '/', "." is the directory itself and ".." its parent
+// they resolve the whole path at once, without changing d
+
+// opens the file at path
+// returns NULL if a component doesn't exist
+FileHandle* SimpleFS_openPath(DirectoryHandle* d, const char* path);
+
+// creates an empty file at path, in an existing directory
+// returns NULL on error (file existing, missing directory, no free blocks)
+FileHandle* SimpleFS_createPath(DirectoryHandle* d, const char* path);
+
+// creates a directory at path, in an existing directory
+// 0 on success
+// -1 on error
+int SimpleFS_mkDirPath(DirectoryHandle* d, const char* path);
+
+// removes the file or directory at path, a directory with all its contents
+// the directory of d and the directories containing it can't be removed
+// returns -1 on failure 0 on success
+int SimpleFS_removePath(DirectoryHandle* d, const char* path);
+
+// copies in fcb the control block of the file or directory at path (the file if both exist)
+// returns -1 if it doesn't exist 0 on success
+int SimpleFS_stat(DirectoryHandle* d, const char* path, FileControlBlock* fcb);
 
+// converts filename, an image of the first layout (a header of three ints, 512 bytes blocks), to the current one
+// filename is replaced by a copy with the same files and directories and a quarter more blocks
+// returns the number of files and directories copied, -1 if filename isn't such an image or the copy fails
+int SimpleFS_migrate(const char* filename);
@@ -1,5 +1,9 @@
+#define _GNU_SOURCE
 #include "bitmap.c"
 #include "disk_driver.c"
+#include "block_cache.c"
+#include "slab.c"
+#include "arena.c"
 #include "simplefs.c"
 #include <stdio.h>
 #include <string.h>
@@ -21,6 +25,23 @@ int main(int argc, char** argv) {
 	
 	DiskDriver_init(disk, TEST_PATH, BLOCKS);
 	
+	// an image of the first layout is converted, keeping its files
+	if(!disk->header && SimpleFS_migrate(TEST_PATH) != -1) {
+		printf("\n%s converted to the current layout\n", TEST_PATH);
+		DiskDriver_init(disk, TEST_PATH, BLOCKS);
+	}
+
+	// a file that isn't a disk image is formatted only if the user agrees
+	char answer[8] = "";
+	if(!disk->header) {
+		printf("\n%s is not a disk image, format it? (yes/no):\n", TEST_PATH);
+		if(scanf("%7s", answer) == 1 && strcmp(answer, "yes") == 0) DiskDriver_format(disk, TEST_PATH, BLOCKS, DISK_DEFAULT_BLOCK_SIZE, DISK_BACKEND_MMAP);
+	}
+	if(!disk->header) {
+		printf("\nDisk opening error\n");
+		return 0;
+	}
+	
 	DirectoryHandle * directory_handle = SimpleFS_init(fs, disk);
 	if(directory_handle) {
 		printf("\nFile System created and initlialized successfully\n");
@@ -29,15 +50,16 @@ int main(int argc, char** argv) {
 		return 0;
 	}
 	
-	char** list = (char**) malloc(sizeof(char*)*directory_handle->dcb->num_entries);
-	for(i = 0; i < directory_handle->dcb->num_entries; i++) {
-		list[i] = (char*) malloc(125);
-	}
+	// ls lists the directory a page at a time
+	DirRecord records[16];
+	int n;
 
 	char quest[125] = " ";
 	
 	while(strcmp(quest, "quit") != 0){
 		
+		// while waiting for the next command, frees the blocks of a removed file or directory
+		SimpleFS_reclaim(fs, 1);
 		
 		printf("\nWhat do you want to do? (type help for help) (quit to exit):\n");
 		scanf("%s", quest);
@@ -53,13 +75,12 @@ int main(int argc, char** argv) {
 			printf("\nType seek on a file\n");
 		}
 		else if(strcmp(quest, "ls") == 0){
-			list = (char**) malloc(sizeof(char*)*directory_handle->dcb->num_entries);
-			for(i = 0; i < directory_handle->dcb->num_entries; i++) {
-				list[i] = (char*) malloc(125);
-			}
-			SimpleFS_readDir(list, directory_handle);
-			for(i = 0; i < directory_handle->dcb->num_entries; i++) {
-				printf(" - > %s\n", list[i]);
+			SimpleFS_rewindDir(directory_handle);
+			while((n = SimpleFS_readDirRecords(directory_handle, records, 16)) > 0) {
+				for(i = 0; i < n; i++) {
+					if(records[i].is_dir) printf(" - > %s/\n", records[i].name);
+					else printf(" - > %s (%d bytes)\n", records[i].name, records[i].size_in_bytes);
+				}
 			}
 		}
 		else if(strcmp(quest, "cd") == 0){
@@ -130,13 +151,16 @@ int main(int argc, char** argv) {
 			scanf("%s", quest);
 			fl = SimpleFS_openFile(directory_handle, quest);
 			if(fl){
-				char* content[125];
 				int size = fl->fcb->fcb.size_in_bytes;
+				char* content = (char*) malloc(size+1);
 				ret = SimpleFS_read(fl, (void*)content, size);
-				if(ret != -1)
-					printf("File read successfully:\n%s\n", (char*)content);
+				if(ret != -1) {
+					content[ret] = '\0';
+					printf("File read successfully:\n%s\n", content);
+				}
 				else
 					printf("File write error\n");
+				free(content);
 			}
 			else
 				printf("\nFile not found\n");
@@ -165,9 +189,9 @@ int main(int argc, char** argv) {
 	printf("Closing %s\n", directory_handle->dcb->fcb.name);
 	printf("Closing disk driver\n");
 	printf("Closing simple file system\n");
-	free(list);
 	SimpleFS_close(fl);
-	free(directory_handle);
+	SimpleFS_closeDir(directory_handle);
+	SimpleFS_destroy(fs);
 	DiskDriver_destroy(disk);
 	free(fs);
  
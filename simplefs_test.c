@@ -1,5 +1,9 @@
+#define _GNU_SOURCE
 #include "bitmap.c"
 #include "disk_driver.c"
+#include "block_cache.c"
+#include "slab.c"
+#include "arena.c"
 #include "simplefs.c"
 #include <stdio.h>
 #include <string.h>
@@ -21,11 +25,20 @@ int main(int argc, char** argv) {
 		printf("\nIf you want to test the bitmap module's functions: code = bitmap\n");
 		printf("\nIf you want to test the disk driver module's functions: code = disk_driver\n");
 		printf("\nIf you want to test the file system: code = simplefs\n");
+		printf("\nThe disk driver and file system tests take the disk backend as optional second argument: mmap (default), pread, direct or uring\n");
+		printf("\nand the block size of a new disk as optional third argument: from 512 (default) to 65536\n");
 		return 0;
 	}
 	
 	char* test = argv[1];
 	
+	// disk backend used by the disk driver and file system tests
+	DiskBackendType backend = DISK_BACKEND_MMAP;
+	if(argc > 2 && strcmp(argv[2], "pread") == 0) backend = DISK_BACKEND_PREAD;
+	if(argc > 2 && strcmp(argv[2], "direct") == 0) backend = DISK_BACKEND_DIRECT;
+	if(argc > 2 && strcmp(argv[2], "uring") == 0) backend = DISK_BACKEND_URING;
+	int block_size = argc > 3 ? atoi(argv[3]) : DISK_DEFAULT_BLOCK_SIZE;
+	
 	//BITMAP TEST
 	if(strcmp(test, "bitmap") == 0){
 		printf("BITMAP FUNCTIONS TEST\n");
@@ -49,8 +62,7 @@ int main(int argc, char** argv) {
 		printf("*** Testing BitMap_set(BitMap* bmap, int pos, int status) ***\n");
 		
 		BitMap* bitmap = (BitMap*) malloc(sizeof(BitMap));
-		bitmap->entries = (char*) calloc(BLOCKS/8,sizeof(char));
-		bitmap->num_bits = BLOCKS;
+		BitMap_init(bitmap, BLOCKS, (char*) calloc(BLOCKS/8,sizeof(char)));
 		printf("\nNumber of blocks = %d, number of bitmap entries = %d\n", BLOCKS, BLOCKS/8); 
 		
 		printf("\nBitMap_get returns the index of the first block in a status, -1 otherwise\n");
@@ -76,6 +88,21 @@ int main(int argc, char** argv) {
 		printf("BitMap_set(bitmap, 0, 0) returns -> %d    {Expected: 0}\n", BitMap_set(bitmap, 0, 0));
 		
 		printf("BitMap_get(bitmap, 0, 0) returns -> %d    {Expected: 0}\n", BitMap_get(bitmap, 0, 0));
+
+		printf("\nSetting blocks from 0 to 699 to 1, searches have to cross several words\n");
+		for(pos = 0; pos < 700; pos++) BitMap_set(bitmap, pos, 1);
+		printf("BitMap_get(bitmap, 0, 0) returns -> %d    {Expected: 700}\n", BitMap_get(bitmap, 0, 0));
+		printf("BitMap_get(bitmap, 701, 1) returns -> %d    {Expected: 998}\n", BitMap_get(bitmap, 701, 1));
+		printf("BitMap_get(bitmap, 998, 0) returns -> %d    {Expected: 999}\n", BitMap_get(bitmap, 998, 0));
+		printf("BitMap_get(bitmap, 999, 1) returns -> %d    {Expected: -1}\n", BitMap_get(bitmap, 999, 1));
+
+		// BitMap_clearSorted(BitMap* bmap, const int* pos, int n)
+		printf("\n*** Testing BitMap_clearSorted(BitMap* bmap, const int* pos, int n) ***\n");
+		int sorted[] = { 3, 10, 63, 64, 65, 699, 700 };
+		printf("\nBitMap_clearSorted(bitmap, {3, 10, 63, 64, 65, 699, 700}, 7) returns -> %d    {Expected: 6}\n", BitMap_clearSorted(bitmap, sorted, 7));
+		printf("BitMap_get(bitmap, 0, 0) returns -> %d    {Expected: 3}\n", BitMap_get(bitmap, 0, 0));
+		printf("BitMap_get(bitmap, 11, 0) returns -> %d    {Expected: 63}\n", BitMap_get(bitmap, 11, 0));
+		printf("BitMap_get(bitmap, 66, 0) returns -> %d    {Expected: 699}\n", BitMap_get(bitmap, 66, 0));
 	
 		printf("\nDestroying bitmap\n");
 		BitMap_destroy(bitmap);
@@ -88,9 +115,22 @@ int main(int argc, char** argv) {
 		// DiskDriver_init(DiskDriver* disk, const char* filename, int num_blocks)
 		printf("\n*** Testing DiskDriver_init(DiskDriver* disk, const char* filename, int num_blocks) ***\n");
 		DiskDriver* disk = (DiskDriver*) malloc(sizeof(DiskDriver));
-		DiskDriver_init(disk, TEST_PATH, BLOCKS);
-		
-		int block_num = disk->header->first_free_block;
+
+		// a file that isn't a disk image is left as it is
+		FILE* junk = fopen("notadisk.txt", "w");
+		fputs("not a disk", junk);
+		fclose(junk);
+		DiskDriver_initBackend(disk, "notadisk.txt", BLOCKS, block_size, backend);
+		struct stat junk_stat;
+		stat("notadisk.txt", &junk_stat);
+		printf("\nOpening notadisk.txt fails: %d, its size is still %ld    {Expected: 1, 10}\n", disk->header == NULL, (long) junk_stat.st_size);
+		unlink("notadisk.txt");
+
+		DiskDriver_initBackend(disk, TEST_PATH, BLOCKS, block_size, backend);
+
+		// the test disk is formatted again if it holds something else
+		if(!disk->header) DiskDriver_format(disk, TEST_PATH, BLOCKS, block_size, backend);
+		int block_num = disk->header ? disk->header->first_free_block : -1;
 		
 		if(block_num == -1){
 			printf("Disk driver initialization error\n");
@@ -105,14 +145,18 @@ int main(int argc, char** argv) {
 		printf("\n*** Testing DiskDriver_readBlock(DiskDriver* disk, void* dest, int block_num) ***\n");
 		printf("\n*** Testing DiskDriver_writeBlock(DiskDriver* disk, void* src, int block_num) ***\n");
 		
+		// the driver moves whole blocks
 		char* in = "pippo";
-		void* src = (void*) in;
+		void* src = calloc(1, disk->block_size);
+		strcpy((char*) src, in);
+		void* other = calloc(1, disk->block_size);
+		strcpy((char*) other, "paperino");
 
 		printf("\nWriting data = %s in block %d\n", in, block_num);
 		int ret = DiskDriver_writeBlock(disk, src, block_num);
 		printf("Function returned %d, data successfully written in block %d\n", ret, block_num);
 
-		void* dest = (void*) malloc(BLOCK_SIZE);
+		void* dest = (void*) malloc(disk->block_size);
 		printf("\nRetrieving data from block %d\n", block_num);
 		ret = DiskDriver_readBlock(disk, dest, block_num);
 		printf("Function returned %d, data = %s\n", ret, (char*)dest);
@@ -122,7 +166,7 @@ int main(int argc, char** argv) {
 		printf("Function returned %d, data not written in block %d\n", ret, -1);
 
 		printf("\nWriting data = paperino in block %d\n", block_num+3);
-		ret = DiskDriver_writeBlock(disk, "paperino", block_num+3);
+		ret = DiskDriver_writeBlock(disk, other, block_num+3);
 		printf("Function returned %d, data successfully written in block %d\n", ret, block_num+3);
 		
 		printf("\nRetrieving data from block %d\n", block_num+3);
@@ -157,8 +201,47 @@ int main(int argc, char** argv) {
 		ret += DiskDriver_writeBlock(disk, src, block_num);                    //Tries writing in a non free block
 		ret += DiskDriver_writeBlock(disk, src, block_num+BLOCKS);             //Tries writing in an out of range block
 		
+		// DiskDriver_setSyncMode(DiskDriver* disk, DiskSyncMode mode, int interval)
+		// DiskDriver_flush(DiskDriver* disk)
+		printf("\n*** Testing DiskDriver_setSyncMode(DiskDriver* disk, DiskSyncMode mode, int interval) ***\n");
+		printf("*** Testing DiskDriver_flush(DiskDriver* disk) ***\n");
+		
+		printf("\nDiskDriver_setSyncMode(disk, DISK_SYNC_TIMED, 0) returns -> %d    {Expected: -1}\n", DiskDriver_setSyncMode(disk, DISK_SYNC_TIMED, 0));
+		printf("DiskDriver_setSyncMode(disk, DISK_SYNC_TIMED, 10) returns -> %d    {Expected: 0}\n", DiskDriver_setSyncMode(disk, DISK_SYNC_TIMED, 10));
+		printf("DiskDriver_writeBlock(disk, src, %d) returns -> %d    {Expected: 0}\n", block_num, DiskDriver_writeBlock(disk, src, block_num));
+		printf("DiskDriver_setSyncMode(disk, DISK_SYNC_EXPLICIT, 0) returns -> %d    {Expected: 0}\n", DiskDriver_setSyncMode(disk, DISK_SYNC_EXPLICIT, 0));
+		printf("DiskDriver_writeBlock(disk, src, %d) returns -> %d    {Expected: 0}\n", block_num, DiskDriver_writeBlock(disk, src, block_num));
+		printf("DiskDriver_flush(disk) returns -> %d    {Expected: 0}\n", DiskDriver_flush(disk));
+		
+		// DiskDriver_writeBlocks(DiskDriver* disk, const int* block_nums, void** bufs, int n)
+		// DiskDriver_readBlocks(DiskDriver* disk, const int* block_nums, void** bufs, int n)
+		// DiskDriver_freeBlocks(DiskDriver* disk, const int* block_nums, int n)
+		printf("\n*** Testing DiskDriver_writeBlocks(DiskDriver* disk, const int* block_nums, void** bufs, int n) ***\n");
+		printf("*** Testing DiskDriver_readBlocks(DiskDriver* disk, const int* block_nums, void** bufs, int n) ***\n");
+		printf("*** Testing DiskDriver_freeBlocks(DiskDriver* disk, const int* block_nums, int n) ***\n");
+		
+		int batch[3] = { 12, 10, 11 };
+		void* bufs[3];
+		int i;
+		for(i = 0; i < 3; i++) {
+			bufs[i] = calloc(1, disk->block_size);
+			sprintf((char*) bufs[i], "block %d", batch[i]);
+		}
+		int free_blocks = disk->header->free_blocks;
+		printf("\nDiskDriver_writeBlocks(disk, {12, 10, 11}, bufs, 3) returns -> %d    {Expected: 0}\n", DiskDriver_writeBlocks(disk, batch, bufs, 3));
+		printf("Free blocks decreased by %d    {Expected: 3}\n", free_blocks - disk->header->free_blocks);
+		for(i = 0; i < 3; i++) memset(bufs[i], 0, disk->block_size);
+		printf("DiskDriver_readBlocks(disk, {12, 10, 11}, bufs, 3) returns -> %d    {Expected: 0}\n", DiskDriver_readBlocks(disk, batch, bufs, 3));
+		printf("Read %s, %s, %s    {Expected: block 12, block 10, block 11}\n", (char*) bufs[0], (char*) bufs[1], (char*) bufs[2]);
+		printf("DiskDriver_freeBlocks(disk, {12, 10, 11}, 3) returns -> %d    {Expected: 0}\n", DiskDriver_freeBlocks(disk, batch, 3));
+		printf("DiskDriver_readBlocks(disk, {12, 10, 11}, bufs, 3) returns -> %d    {Expected: -1}\n", DiskDriver_readBlocks(disk, batch, bufs, 3));
+		printf("Free blocks restored: %d    {Expected: 1}\n", free_blocks == disk->header->free_blocks);
+		for(i = 0; i < 3; i++) free(bufs[i]);
+		
 		printf("\nClosing disk driver\n");
 		free(dest);
+		free(src);
+		free(other);
 		DiskDriver_destroy(disk);
 		
 	}
@@ -173,7 +256,13 @@ int main(int argc, char** argv) {
 		SimpleFS* fs = (SimpleFS*) malloc(sizeof(SimpleFS));
 		DiskDriver* disk = (DiskDriver*) malloc(sizeof(DiskDriver));
 		
-		DiskDriver_init(disk, TEST_PATH, BLOCKS);
+		DiskDriver_initBackend(disk, TEST_PATH, BLOCKS, block_size, backend);
+		if(!disk->header && SimpleFS_migrate(TEST_PATH) != -1) DiskDriver_initBackend(disk, TEST_PATH, BLOCKS, block_size, backend);
+		if(!disk->header) DiskDriver_format(disk, TEST_PATH, BLOCKS, block_size, backend);
+		if(!disk->header) {
+			printf("Disk driver initialization error\n");
+			return 0;
+		}
 	
 		DirectoryHandle * directory_handle = SimpleFS_init(fs, disk);
 		if(directory_handle) {
@@ -275,15 +364,219 @@ int main(int argc, char** argv) {
 		printf("\n*** Testing SimpleFS_read(FileHandle* f, void* data, int size) ***\n");
 		printf("*** Testing SimpleFS_seek(FileHandle* f, int pos) ***\n");
 		int size = fl->fcb->fcb.size_in_bytes;
-		char data[size];
-		SimpleFS_read(fl, (void*)data, size);
+		char data[size+1];
+		SimpleFS_seek(fl, 0);
+		ret = SimpleFS_read(fl, (void*)data, size);
+		data[ret] = '\0';
 		printf("%s now contains:\n%s\n", fl->fcb->fcb.name, data);
 		printf("\nChanging the file cursor to 80 and writing INSERT in the file\n");
 		ret = SimpleFS_seek(fl, 80);
 		ret = SimpleFS_write(fl, " INSERT ", strlen(" INSERT "));
 		size = fl->fcb->fcb.size_in_bytes;
-		SimpleFS_read(fl, (void*)data, size);
+		SimpleFS_seek(fl, 0);
+		ret = SimpleFS_read(fl, (void*)data, size);
+		data[ret] = '\0';
 		printf("%s now contains:\n%s\n", fl->fcb->fcb.name, data);
+		printf("Reading 10 bytes from position 15 returns -> %d    {Expected: 10}\n", (SimpleFS_seek(fl, 15), SimpleFS_read(fl, (void*)data, 10)));
+		data[10] = '\0';
+		printf("Read \"%s\", cursor at %d    {Expected: \"restate fe\", cursor at 25}\n", data, fl->pos_in_file);
+		printf("Reading past the end returns -> %d    {Expected: 0}\n", (SimpleFS_seek(fl, size), SimpleFS_read(fl, (void*)data, 10)));
+		printf("SimpleFS_seek(fl, 400) returns -> %d    {Expected: 400}\n", SimpleFS_seek(fl, 400));
+		printf("SimpleFS_seek(fl, 15) returns -> %d    {Expected: 15}\n", SimpleFS_seek(fl, 15));
+		ret = SimpleFS_read(fl, (void*)data, 10);
+		data[10] = '\0';
+		printf("Read \"%s\" after seeking back    {Expected: \"restate fe\"}\n", data);
+		printf("SimpleFS_seek(fl, %d) returns -> %d    {Expected: -1}\n", size+1, SimpleFS_seek(fl, size+1));
+		
+		// random access through the index of a file of many blocks
+		printf("\nWriting 20000 bytes in big.txt and reading them back from scattered positions\n");
+		FileHandle* big = SimpleFS_createFile(directory_handle, "big.txt");
+		if(!big) big = SimpleFS_openFile(directory_handle, "big.txt");
+		char* pattern = (char*) malloc(20000);
+		for(i = 0; i < 20000; i++) pattern[i] = 'a' + i % 26;
+		printf("SimpleFS_write(big, pattern, 20000) returns -> %d    {Expected: 20000}\n", SimpleFS_write(big, pattern, 20000));
+		int extents = 0;
+		for(i = 0; i < SIMPLEFS_EXTENTS; i++) extents += big->fcb->fcb.extents[i].length != 0;
+		printf("big.txt is in %d extent(s), has an index block: %d    {Expected: 1 extent(s), has an index block: 0}\n", extents, big->fcb->fcb.index_block != -1);
+		int errors = 0, pos;
+		for(i = 0; i < 100; i++) {
+			pos = (i * 7919) % 19990;
+			if(SimpleFS_seek(big, pos) != pos || SimpleFS_read(big, (void*)data, 10) != 10 || memcmp(data, pattern + pos, 10)) errors++;
+		}
+		printf("Wrong reads: %d    {Expected: 0}\n", errors);
+
+		// once read, the blocks of big.txt stay in the block cache
+		char* whole = (char*) malloc(20000);
+		SimpleFS_seek(big, 0);
+		SimpleFS_read(big, whole, 20000);
+		long misses = fs->cache.misses;
+		SimpleFS_seek(big, 0);
+		ret = SimpleFS_read(big, whole, 20000);
+		misses = fs->cache.misses - misses;
+		printf("Reading big.txt again returns -> %d, reads %ld block(s) from the disk    {Expected: 20000, 0}\n", ret, misses);
+		free(whole);
+		SimpleFS_close(big);
+
+		// in append mode the writes go at the end, wherever the cursor is
+		big = SimpleFS_openFileFlags(directory_handle, "big.txt", SIMPLEFS_APPEND);
+		size = big->fcb->fcb.size_in_bytes;
+		SimpleFS_seek(big, 0);
+		ret = SimpleFS_write(big, "tail", 4);
+		int grown = big->fcb->fcb.size_in_bytes - size;
+		SimpleFS_seek(big, size);
+		SimpleFS_read(big, data, 4);
+		printf("Appending \"tail\" to big.txt from position 0 returns -> %d, the file grows by %d, ends with \"%.4s\"    {Expected: 4, 4, \"tail\"}\n", ret, grown, data);
+
+		// cutting big.txt frees its blocks past the new end, fallocate reserves them again in one run
+		int before = disk->header->free_blocks;
+		ret = SimpleFS_truncate(big, 1000);
+		int freed = disk->header->free_blocks > before;
+		size = big->fcb->fcb.size_in_bytes;
+		errors = 0;
+		for(pos = 0; pos < 1000; pos += 10) {
+			if(SimpleFS_seek(big, pos) != pos || SimpleFS_read(big, (void*)data, 10) != 10 || memcmp(data, pattern + pos, 10)) errors++;
+		}
+		printf("SimpleFS_truncate(big, 1000) returns -> %d, size %d, blocks freed: %d, wrong reads: %d    {Expected: 0, size 1000, blocks freed: 1, wrong reads: 0}\n", ret, size, freed, errors);
+		before = disk->header->free_blocks;
+		ret = SimpleFS_fallocate(big, 20000);
+		int reserved = before - disk->header->free_blocks;
+		printf("SimpleFS_fallocate(big, 20000) returns -> %d, free blocks decreased by %d, size %d    {Expected: %d, %d, size 1000}\n", ret, reserved, big->fcb->fcb.size_in_bytes, ret, ret);
+		SimpleFS_write(big, pattern + 1000, 19000);
+		extents = 0;
+		for(i = 0; i < SIMPLEFS_EXTENTS; i++) extents += big->fcb->fcb.extents[i].length != 0;
+		printf("Writing big.txt back to 20000 bytes leaves it in %d extent(s), free blocks decreased by %d    {Expected: 1 extent(s), %d}\n", extents, before - disk->header->free_blocks, ret);
+		SimpleFS_close(big);
+
+		// two files growing together keep their blocks in runs
+		printf("\nAppending 2000 bytes at a time to log_a.txt and log_b.txt alternately\n");
+		int free_blocks = disk->header->free_blocks;
+		FileHandle* log_a = SimpleFS_createFile(directory_handle, "log_a.txt");
+		FileHandle* log_b = SimpleFS_createFile(directory_handle, "log_b.txt");
+		for(i = 0; i < 10; i++) {
+			SimpleFS_write(log_a, pattern, 2000);
+			SimpleFS_write(log_b, pattern, 2000);
+		}
+		int extents_a = 0, extents_b = 0;
+		for(i = 0; i < SIMPLEFS_EXTENTS; i++) {
+			extents_a += log_a->fcb->fcb.extents[i].length != 0;
+			extents_b += log_b->fcb->fcb.extents[i].length != 0;
+		}
+		printf("log_a.txt is in %d extent(s), log_b.txt in %d    {Expected: at most %d each}\n", extents_a, extents_b, SIMPLEFS_EXTENTS);
+		errors = 0;
+		SimpleFS_seek(log_b, 0);
+		for(i = 0; i < 10; i++) {
+			if(SimpleFS_read(log_b, (void*)data, 10) != 10 || memcmp(data, pattern, 10)) errors++;
+			SimpleFS_seek(log_b, log_b->pos_in_file + 1990);
+		}
+		printf("Wrong reads: %d    {Expected: 0}\n", errors);
+		reserved = log_a->fcb->fcb.prealloc_blocks + log_b->fcb->fcb.prealloc_blocks;
+		before = disk->header->free_blocks;
+		SimpleFS_close(log_a);
+		SimpleFS_close(log_b);
+		printf("Closing them frees %d block(s) reserved for their growth    {Expected: %d}\n", disk->header->free_blocks - before, reserved);
+		SimpleFS_remove(directory_handle, "log_a.txt");
+		SimpleFS_remove(directory_handle, "log_b.txt");
+		SimpleFS_reclaim(fs, 0);
+		printf("Free blocks after removing them: %d    {Expected: %d}\n", disk->header->free_blocks, free_blocks);
+		free(pattern);
+
+		// lookups in a big directory go through its hash table
+		printf("\nCreating 300 files in dir many and opening them by name\n");
+		free_blocks = disk->header->free_blocks;
+		long buffers = fs->buffers.in_use, handles = fs->file_handles.in_use;
+		SimpleFS_mkDir(directory_handle, "many");
+		SimpleFS_changeDir(directory_handle, "many");
+		for(i = 0; i < 300; i++) {
+			sprintf(filename, "file_%d.txt", i);
+			SimpleFS_close(SimpleFS_createFile(directory_handle, filename));
+		}
+		printf("many has a hash table: %d    {Expected: 1}\n", directory_handle->dcb->fcb.index_block != -1);
+		errors = 0;
+		for(i = 0; i < 300; i++) {
+			sprintf(filename, "file_%d.txt", i);
+			FileHandle* entry = SimpleFS_openFile(directory_handle, filename);
+			if(!entry || strcmp(entry->fcb->fcb.name, filename)) errors++;
+			SimpleFS_close(entry);
+		}
+		printf("Wrong lookups: %d, missing file found: %d    {Expected: 0, 0}\n", errors, SimpleFS_openFile(directory_handle, "file_300.txt") != NULL);
+		// the directory is listed 32 records at a time
+		DirRecord records[32];
+		char* seen = (char*) calloc(300, 1);
+		int listed = 0, n;
+		errors = 0;
+		SimpleFS_rewindDir(directory_handle);
+		while((n = SimpleFS_readDirRecords(directory_handle, records, 32)) > 0) {
+			for(i = 0; i < n; i++) {
+				int num = -1;
+				if(sscanf(records[i].name, "file_%d.txt", &num) != 1 || num < 0 || num >= 300 || seen[num]++ || records[i].is_dir) errors++;
+			}
+			listed += n;
+		}
+		free(seen);
+		printf("SimpleFS_readDirRecords lists %d entries, %d wrong, then returns -> %d    {Expected: 300, 0, 0}\n", listed, errors, n);
+		SimpleFS_changeDir(directory_handle, "..");
+		SimpleFS_remove(directory_handle, "many");
+		SimpleFS_reclaim(fs, 0);
+		printf("Free blocks after removing many: %d    {Expected: %d}\n", disk->header->free_blocks, free_blocks);
+
+		// a tree is removed in one pass, and a file before a directory with the same name
+		printf("\nRemoving the file tree, then the directory tree with 5 nested levels\n");
+		SimpleFS_mkDir(directory_handle, "tree");
+		SimpleFS_changeDir(directory_handle, "tree");
+		for(i = 0; i < 5; i++) {
+			sprintf(filename, "level_%d", i);
+			SimpleFS_mkDir(directory_handle, filename);
+			SimpleFS_changeDir(directory_handle, filename);
+			SimpleFS_close(SimpleFS_createFile(directory_handle, "leaf.txt"));
+		}
+		for(i = 0; i < 6; i++) SimpleFS_changeDir(directory_handle, "..");
+		SimpleFS_close(SimpleFS_createFile(directory_handle, "tree"));
+		ret = SimpleFS_remove(directory_handle, "tree");
+		int dir_left = SimpleFS_findDir(directory_handle, "tree") != -1;
+		printf("SimpleFS_remove(\"tree\") returns -> %d, directory left: %d, still in dir %s    {Expected: 0, 1, /}\n", ret, dir_left, directory_handle->dcb->fcb.name);
+		ret = SimpleFS_remove(directory_handle, "tree");
+		int queued = disk->header->reclaim_count, still_used = disk->header->free_blocks < free_blocks;
+		printf("SimpleFS_remove(\"tree\") returns -> %d, entries to reclaim %d, blocks still used: %d    {Expected: 0, 2, 1}\n", ret, queued, still_used);
+
+		// the removed blocks are freed later, a whole tree at once
+		ret = SimpleFS_reclaim(fs, 0);
+		printf("SimpleFS_reclaim(fs, 0) returns -> %d, free blocks %d    {Expected: 2, free blocks %d}\n", ret, disk->header->free_blocks, free_blocks);
+		buffers = fs->buffers.in_use - buffers;
+		handles = fs->file_handles.in_use - handles;
+		printf("Buffers and file handles left in use: %ld, %ld    {Expected: 0, 0}\n", buffers, handles);
+
+		// repeated lookups are answered by the dentry cache, also for missing names
+		SimpleFS_close(SimpleFS_openFile(directory_handle, "big.txt"));
+		int hits = fs->dcache.hits;
+		for(i = 0; i < 100; i++) SimpleFS_close(SimpleFS_openFile(directory_handle, "big.txt"));
+		printf("\nOpening big.txt 100 more times hits the dentry cache %d times    {Expected: 100}\n", fs->dcache.hits - hits);
+		SimpleFS_openFile(directory_handle, "missing.txt");
+		hits = fs->dcache.hits;
+		FileHandle* missing = SimpleFS_openFile(directory_handle, "missing.txt");
+		printf("Opening missing.txt again returns -> %p, hits the dentry cache %d time(s)    {Expected: (nil), 1}\n", (void*) missing, fs->dcache.hits - hits);
+
+		// SimpleFS_mkDirPath, SimpleFS_createPath, SimpleFS_openPath, SimpleFS_stat, SimpleFS_removePath
+		printf("\n*** Testing the path based operations ***\n");
+		free_blocks = disk->header->free_blocks;
+		printf("SimpleFS_mkDirPath(\"/p1\") returns -> %d    {Expected: 0}\n", SimpleFS_mkDirPath(directory_handle, "/p1"));
+		printf("SimpleFS_mkDirPath(\"/p1/p2\") returns -> %d    {Expected: 0}\n", SimpleFS_mkDirPath(directory_handle, "/p1/p2"));
+		printf("SimpleFS_mkDirPath(\"/p1/none/p3\") returns -> %d    {Expected: -1}\n", SimpleFS_mkDirPath(directory_handle, "/p1/none/p3"));
+		FileHandle* deep = SimpleFS_createPath(directory_handle, "/p1/p2/deep.txt");
+		printf("SimpleFS_createPath(\"/p1/p2/deep.txt\") returns a handle: %d    {Expected: 1}\n", deep != NULL);
+		SimpleFS_write(deep, "deep", 4);
+		SimpleFS_close(deep);
+		deep = SimpleFS_openPath(directory_handle, "p1/./p2/../p2//deep.txt");
+		printf("SimpleFS_openPath(\"p1/./p2/../p2//deep.txt\") opens -> %s    {Expected: deep.txt}\n", deep ? deep->fcb->fcb.name : "NULL");
+		SimpleFS_close(deep);
+		FileControlBlock stat;
+		ret = SimpleFS_stat(directory_handle, "/p1/p2/deep.txt", &stat);
+		printf("SimpleFS_stat(\"/p1/p2/deep.txt\") returns -> %d, size %d    {Expected: 0, size 4}\n", ret, stat.size_in_bytes);
+		ret = SimpleFS_stat(directory_handle, "/p1/p2", &stat);
+		printf("SimpleFS_stat(\"/p1/p2\") returns -> %d, is_dir %d    {Expected: 0, is_dir 1}\n", ret, stat.is_dir);
+		printf("SimpleFS_removePath(\"/p1\") returns -> %d    {Expected: 0}\n", SimpleFS_removePath(directory_handle, "/p1"));
+		printf("SimpleFS_stat(\"/p1/p2/deep.txt\") returns -> %d    {Expected: -1}\n", SimpleFS_stat(directory_handle, "/p1/p2/deep.txt", &stat));
+		SimpleFS_reclaim(fs, 0);
+		printf("Still in dir %s, free blocks %d    {Expected: /, free blocks %d}\n", directory_handle->dcb->fcb.name, disk->header->free_blocks, free_blocks);
 
 		// SimpleFS_remove(DirectoryHandle* d, char* filename)
 		printf("\n*** Testing SimpleFS_remove(DirectoryHandle* d, char* filename) ***\n");
@@ -341,13 +634,79 @@ int main(int argc, char** argv) {
 			printf(" - > %s\n", list[i]);
 		}
 		
+		printf("\nSimpleFS_reclaim(fs, 0) frees the blocks of %d removed dir(s)    {Expected: 1}\n", SimpleFS_reclaim(fs, 0));
+
+		// formatting drops the removed files still waiting to be reclaimed, on a scratch disk
+		SimpleFS* scratch_fs = (SimpleFS*) malloc(sizeof(SimpleFS));
+		DiskDriver* scratch_disk = (DiskDriver*) malloc(sizeof(DiskDriver));
+		DiskDriver_format(scratch_disk, "formatdisk.txt", BLOCKS, block_size, backend);
+		DirectoryHandle* scratch_root = SimpleFS_init(scratch_fs, scratch_disk);
+		SimpleFS_close(SimpleFS_createFile(scratch_root, "old.txt"));
+		SimpleFS_remove(scratch_root, "old.txt");
+		SimpleFS_closeDir(scratch_root);
+		SimpleFS_format(scratch_fs);
+		SimpleFS_destroy(scratch_fs);
+		scratch_root = SimpleFS_init(scratch_fs, scratch_disk);
+		FileHandle* fresh = SimpleFS_createFile(scratch_root, "new.txt");
+		SimpleFS_write(fresh, "new", 4);
+		printf("\nAfter SimpleFS_format, entries to reclaim %d, free blocks counted right: %d",
+			scratch_disk->header->reclaim_count, scratch_disk->header->free_blocks == BitMap_count(scratch_disk->map, 0));
+		printf(", SimpleFS_reclaim(fs, 0) returns -> %d, new.txt still used: %d    {Expected: 0, 1, 0, 1}\n",
+			SimpleFS_reclaim(scratch_fs, 0), BitMap_get(scratch_disk->map, fresh->fcb->fcb.block_in_disk, 1) == fresh->fcb->fcb.block_in_disk);
+		SimpleFS_close(fresh);
+		SimpleFS_closeDir(scratch_root);
+		SimpleFS_destroy(scratch_fs);
+		DiskDriver_destroy(scratch_disk);
+		unlink("formatdisk.txt");
+
+		// an image of the first layout, with a.txt and the directory sub in the root, is converted
+		char legacy[SIMPLEFS_LEGACY_HEADER_SIZE + 8 + 8 * SIMPLEFS_LEGACY_BLOCK_SIZE];
+		memset(legacy, 0, sizeof(legacy));
+		int legacy_header[3] = {8, 5, 3};
+		memcpy(legacy, legacy_header, sizeof(legacy_header));
+		memset(legacy + SIMPLEFS_LEGACY_HEADER_SIZE, 1, 3);
+		char* legacy_blocks = legacy + SIMPLEFS_LEGACY_HEADER_SIZE + 8;
+		LegacyFirstDirectoryBlock* legacy_root = (LegacyFirstDirectoryBlock*) legacy_blocks;
+		LegacyFirstFileBlock* legacy_file = (LegacyFirstFileBlock*) (legacy_blocks + SIMPLEFS_LEGACY_BLOCK_SIZE);
+		LegacyFirstDirectoryBlock* legacy_sub = (LegacyFirstDirectoryBlock*) (legacy_blocks + 2 * SIMPLEFS_LEGACY_BLOCK_SIZE);
+		legacy_root->header = (BlockHeader) {-1, -1, 0};
+		legacy_root->fcb = (LegacyFileControlBlock) {-1, 0, "/", 0, 1, 1};
+		legacy_root->num_entries = 2;
+		legacy_root->file_blocks[0] = 1;
+		legacy_root->file_blocks[1] = 2;
+		legacy_file->header = (BlockHeader) {-1, -1, 0};
+		legacy_file->fcb = (LegacyFileControlBlock) {0, 1, "a.txt", 5, 1, 0};
+		memcpy(legacy_file->data, "hello", 5);
+		legacy_sub->header = (BlockHeader) {-1, -1, 0};
+		legacy_sub->fcb = (LegacyFileControlBlock) {0, 2, "sub", 0, 1, 1};
+		FILE* legacy_image = fopen("legacydisk.txt", "w");
+		fwrite(legacy, 1, sizeof(legacy), legacy_image);
+		fclose(legacy_image);
+		int migrated = SimpleFS_migrate("legacydisk.txt");
+		scratch_disk = (DiskDriver*) malloc(sizeof(DiskDriver));
+		DiskDriver_initBackend(scratch_disk, "legacydisk.txt", BLOCKS, block_size, backend);
+		scratch_root = SimpleFS_init(scratch_fs, scratch_disk);
+		FileHandle* legacy_handle = SimpleFS_openPath(scratch_root, "/a.txt");
+		char legacy_data[8] = "";
+		SimpleFS_read(legacy_handle, legacy_data, 5);
+		FileControlBlock legacy_stat;
+		printf("\nSimpleFS_migrate copies %d entries, a.txt reads \"%s\", sub is a directory: %d    {Expected: 2, hello, 1}\n",
+			migrated, legacy_data, SimpleFS_stat(scratch_root, "/sub", &legacy_stat) == 0 && legacy_stat.is_dir);
+		SimpleFS_close(legacy_handle);
+		SimpleFS_closeDir(scratch_root);
+		SimpleFS_destroy(scratch_fs);
+		DiskDriver_destroy(scratch_disk);
+		free(scratch_fs);
+		unlink("legacydisk.txt");
+
 		printf("\nClosing %s\n", fl->fcb->fcb.name);
 		printf("Closing %s\n", directory_handle->dcb->fcb.name);
 		printf("Closing disk driver\n");
 		printf("Closing simple file system\n");
 		free(list);
 		SimpleFS_close(fl);
-		free(directory_handle);
+		SimpleFS_closeDir(directory_handle);
+		SimpleFS_destroy(fs);
 		DiskDriver_destroy(disk);
 		free(fs);
 	}
@@ -0,0 +1,93 @@
+#pragma once
+#include "slab.h"
+#include <stdlib.h>
+
+// bytes of the header of a chunk, the objects after it are aligned
+#define SLAB_HEADER_SIZE ((sizeof(SlabChunk) + SLAB_ALIGN - 1) / SLAB_ALIGN * SLAB_ALIGN)
+
+
+// initializes a slab of objects of object_size bytes, allocated chunk_objects at a time
+int Slab_init(Slab* slab, int object_size, int chunk_objects){
+
+	// security check on input args
+	if(!slab || object_size <= 0 || chunk_objects <= 0) return -1;
+
+	// a free object must hold the link of the free list
+	if(object_size < (int) sizeof(void*)) object_size = sizeof(void*);
+
+	slab->object_size = (object_size + SLAB_ALIGN - 1) / SLAB_ALIGN * SLAB_ALIGN;
+	slab->chunk_objects = chunk_objects;
+	slab->chunks = NULL;
+	slab->free_list = NULL;
+	slab->in_use = 0;
+	slab->allocated = 0;
+
+	return 0;
+}
+
+
+// allocates a new chunk and puts its objects in the free list
+static int Slab_grow(Slab* slab){
+
+	SlabChunk* chunk = (SlabChunk*) malloc(SLAB_HEADER_SIZE + (size_t) slab->chunk_objects * slab->object_size);
+	if(!chunk) return -1;
+
+	chunk->next = slab->chunks;
+	slab->chunks = chunk;
+
+	// the objects are linked backwards, so that the first one is handed out first
+	char* objects = (char*) chunk + SLAB_HEADER_SIZE;
+	int i;
+	for(i = slab->chunk_objects - 1; i >= 0; i--) {
+		void* object = objects + (size_t) i * slab->object_size;
+		*(void**) object = slab->free_list;
+		slab->free_list = object;
+	}
+	slab->allocated += slab->chunk_objects;
+
+	return 0;
+}
+
+
+// returns an object of the slab, NULL if the memory is over
+void* Slab_alloc(Slab* slab){
+
+	// security check on input args
+	if(!slab) return NULL;
+
+	if(!slab->free_list && Slab_grow(slab) == -1) return NULL;
+
+	void* object = slab->free_list;
+	slab->free_list = *(void**) object;
+	slab->in_use++;
+
+	return object;
+}
+
+
+// gives back an object returned by Slab_alloc
+void Slab_free(Slab* slab, void* object){
+
+	if(!slab || !object) return;
+
+	*(void**) object = slab->free_list;
+	slab->free_list = object;
+	slab->in_use--;
+}
+
+
+// frees every chunk of the slab, the objects still in use included
+void Slab_destroy(Slab* slab){
+
+	if(!slab) return;
+
+	while(slab->chunks) {
+		SlabChunk* next = slab->chunks->next;
+		free(slab->chunks);
+		slab->chunks = next;
+	}
+
+	slab->free_list = NULL;
+	slab->in_use = 0;
+	slab->allocated = 0;
+}
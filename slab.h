@@ -0,0 +1,35 @@
+#pragma once
+
+// objects handed out by the allocators are aligned to this many bytes
+#define SLAB_ALIGN 16
+
+// a chunk of a slab, its objects follow the header
+typedef struct SlabChunk {
+  struct SlabChunk* next;
+} SlabChunk;
+
+// pool of objects of one size
+// the objects are carved from chunks allocated together, and the freed ones are kept in a list for reuse
+// the memory goes back to the system only in Slab_destroy
+typedef struct {
+  int object_size;       // rounded up to SLAB_ALIGN
+  int chunk_objects;     // objects of each chunk
+  SlabChunk* chunks;     // every chunk allocated
+  void* free_list;       // freed objects, linked through their first bytes
+  long in_use;           // objects handed out and not freed
+  long allocated;        // objects in the chunks
+} Slab;
+
+// initializes a slab of objects of object_size bytes, allocated chunk_objects at a time
+// returns -1 on wrong args
+int Slab_init(Slab* slab, int object_size, int chunk_objects);
+
+// returns an object of the slab, NULL if the memory is over
+// the content of the object is undefined
+void* Slab_alloc(Slab* slab);
+
+// gives back an object returned by Slab_alloc (NULL is ignored)
+void Slab_free(Slab* slab, void* object);
+
+// frees every chunk of the slab, the objects still in use included
+void Slab_destroy(Slab* slab);